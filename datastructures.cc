@@ -5,11 +5,21 @@
 // Student number:
 
 #include "datastructures.hh"
+#include "mappedimage.hh"
+#include "scheduler.hh"
+#include "writeaheadlog.hh"
 
 #include <random>
 
 #include <cmath>
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string_view>
+
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
 template <typename Type>
@@ -23,6 +33,275 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+namespace
+{
+// Snapshot layout: magic, format version, a byte order mark, payload size and an
+// FNV-1a checksum of the payload, followed by the payload. Numbers are stored
+// in native byte order, the mark catches files written on another machine.
+char const SNAPSHOT_MAGIC[8] = {'P', 'R', 'G', '2', 'S', 'N', 'A', 'P'};
+std::uint32_t const SNAPSHOT_VERSION = 2;
+std::uint32_t const SNAPSHOT_BYTE_ORDER = 0x01020304;
+std::size_t const SNAPSHOT_HEADER_SIZE = sizeof(SNAPSHOT_MAGIC) + 2 * sizeof(std::uint32_t) + 3 * sizeof(std::uint64_t);
+
+std::uint64_t fnv1a(const std::string& data)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+struct SnapshotWriter
+{
+    std::string data;
+
+    template <typename Type>
+    void put(Type value)
+    {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put(const std::string& text)
+    {
+        put<std::uint64_t>(text.size());
+        data.append(text);
+    }
+};
+
+// Reads size bytes of payload without trusting size: where the stream can seek, the
+// bytes left are checked before anything is allocated, otherwise the payload is
+// read in blocks and grows only as far as the stream really goes
+bool readPayload(std::istream& input, std::uint64_t size, std::string& data)
+{
+    std::size_t const BLOCK_SIZE = 1 << 20;
+
+    data.clear();
+    std::istream::pos_type start = input.tellg();
+    if (start != std::istream::pos_type(-1) && input.seekg(0, std::ios::end)) {
+        std::istream::pos_type end = input.tellg();
+        if (!input.seekg(start) || end == std::istream::pos_type(-1) || static_cast<std::uint64_t>(end - start) < size) {
+            return false;
+        }
+        data.reserve(size);
+    } else {
+        input.clear();
+    }
+
+    while (data.size() < size) {
+        std::size_t filled = data.size();
+        std::size_t block = static_cast<std::size_t>(std::min<std::uint64_t>(BLOCK_SIZE, size - filled));
+        data.resize(filled + block);
+        if (!input.read(&data[filled], block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every read is bounds checked, a truncated or garbled payload just makes get fail
+struct SnapshotReader
+{
+    const std::string& data;
+    std::size_t pos = 0;
+
+    template <typename Type>
+    bool get(Type& value)
+    {
+        if (data.size() - pos < sizeof(value)) { return false; }
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool get(std::string& text)
+    {
+        std::uint64_t size = 0;
+        if (!get(size) || data.size() - pos < size) { return false; }
+        text.assign(data, pos, size);
+        pos += size;
+        return true;
+    }
+
+    // A count can't be larger than the bytes left, so a bad one is caught before anything is allocated
+    bool fits(std::uint64_t count) const
+    {
+        return count <= data.size() - pos;
+    }
+};
+
+// Heap memory of a string beyond the string object itself, nothing while it fits the small string buffer
+std::size_t heapBytes(const std::string& text)
+{
+    static const std::size_t inlineCapacity = std::string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+
+template <typename Vector>
+std::size_t heapBytes(const Vector& items)
+{
+    return items.capacity() * sizeof(typename Vector::value_type);
+}
+
+// Search state of the path queries. Every thread has its own, reused from call
+// to call: the pool keeps the nodes the maps free on clear and the vectors keep
+// their capacity, so a repeated search barely allocates and threads share nothing.
+// A search must not start another one while it uses the scratch.
+struct PathScratch
+{
+    std::pmr::unsynchronized_pool_resource pool;
+    std::pmr::unordered_map<AffiliationID, bool> visited{&pool};
+    std::pmr::unordered_map<AffiliationID, AffiliationID> parent{&pool};
+    std::pmr::unordered_map<AffiliationID, Distance> distance{&pool};
+    std::pmr::unordered_map<AffiliationID, Connection> previous{&pool};
+    std::vector<AffiliationID> frontier;
+    std::vector<std::pair<Weight, AffiliationID>> weightHeap;
+    std::vector<std::pair<Distance, AffiliationID>> distanceHeap;
+};
+
+PathScratch& pathScratch()
+{
+    thread_local PathScratch scratch;
+    scratch.visited.clear();
+    scratch.parent.clear();
+    scratch.distance.clear();
+    scratch.previous.clear();
+    scratch.frontier.clear();
+    scratch.weightHeap.clear();
+    scratch.distanceHeap.clear();
+    return scratch;
+}
+
+// Direction-optimizing breadth-first search (Beamer et al.). A level is searched top-down,
+// from the frontier to its unreached neighbours, until the frontier's edges outnumber the
+// unreached affiliations' edges by TOP_DOWN_ALPHA. Then the unreached affiliations look for
+// a neighbour in the frontier bitmap instead (bottom-up), until the frontier shrinks below
+// a BOTTOM_UP_BETA:th of the affiliations.
+std::uint32_t const UNREACHED = std::numeric_limits<std::uint32_t>::max();
+std::size_t const TOP_DOWN_ALPHA = 14;
+std::size_t const BOTTOM_UP_BETA = 24;
+
+// Nodes per task of a level. Smaller levels are searched on one thread, a bottom-up
+// task is a multiple of 64 nodes so that it owns whole words of the bitmap.
+std::size_t const TOP_DOWN_GRAIN = 1 << 10;
+std::size_t const BOTTOM_UP_GRAIN = 1 << 12;
+
+// What a part of a level found: the nodes found top-down, how many were found and their edges
+struct LevelResult
+{
+    std::vector<std::uint32_t> nodes;
+    std::size_t count = 0;
+    std::size_t edges = 0;
+};
+
+LevelResult combineLevels(LevelResult total, LevelResult part)
+{
+    total.nodes.insert(total.nodes.end(), part.nodes.begin(), part.nodes.end());
+    total.count += part.count;
+    total.edges += part.edges;
+    return total;
+}
+
+std::vector<std::uint32_t> hopDistances(const ConnectionGraph& graph, std::uint32_t source)
+{
+    std::size_t nodeCount = graph.ids.size();
+    Scheduler& scheduler = Scheduler::instance();
+    auto degree = [&graph](std::uint32_t node) { return graph.offsets[node + 1] - graph.offsets[node]; };
+
+    // Top-down claims a node with a compare and swap, as several frontier nodes may reach it at once
+    std::vector<std::atomic<std::uint32_t>> distance(nodeCount);
+    for (auto& hops : distance) {
+        hops.store(UNREACHED, std::memory_order_relaxed);
+    }
+    distance[source].store(0, std::memory_order_relaxed);
+
+    std::vector<std::uint32_t> frontier = {source};
+    std::vector<std::uint64_t> frontierBits;
+    std::vector<std::uint64_t> nextBits;
+    std::size_t words = (nodeCount + 63) / 64;
+    std::size_t frontierSize = 1;
+    std::size_t frontierEdges = degree(source);
+    std::size_t unreachedEdges = graph.neighbors.size() - frontierEdges;
+    bool bottomUp = false;
+
+    for (std::uint32_t level = 1; frontierSize > 0; ++level) {
+        if (!bottomUp && frontierEdges > unreachedEdges / TOP_DOWN_ALPHA) {
+            bottomUp = true;
+            frontierBits.assign(words, 0);
+            for (std::uint32_t node : frontier) {
+                frontierBits[node / 64] |= std::uint64_t(1) << (node % 64);
+            }
+        } else if (bottomUp && frontierSize < nodeCount / BOTTOM_UP_BETA) {
+            bottomUp = false;
+            frontier.clear();
+            for (std::size_t word = 0; word < words; ++word) {
+                for (std::size_t bit = 0; bit < 64 && frontierBits[word] >> bit != 0; ++bit) {
+                    if (frontierBits[word] & (std::uint64_t(1) << bit)) {
+                        frontier.push_back(static_cast<std::uint32_t>(word * 64 + bit));
+                    }
+                }
+            }
+        }
+
+        LevelResult found;
+        if (!bottomUp) {
+            found = scheduler.parallel_reduce(frontier.size(), TOP_DOWN_GRAIN, LevelResult(), [&](std::size_t begin, std::size_t end) {
+                LevelResult part;
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::uint32_t node = frontier[i];
+                    for (std::size_t edge = graph.offsets[node]; edge < graph.offsets[node + 1]; ++edge) {
+                        std::uint32_t next = graph.neighbors[edge];
+                        std::uint32_t unreached = UNREACHED;
+                        if (distance[next].load(std::memory_order_relaxed) == UNREACHED &&
+                            distance[next].compare_exchange_strong(unreached, level, std::memory_order_relaxed)) {
+                            part.nodes.push_back(next);
+                            part.edges += degree(next);
+                        }
+                    }
+                }
+                part.count = part.nodes.size();
+                return part;
+            }, combineLevels);
+            frontier.swap(found.nodes);
+        } else {
+            // Every task owns whole words of the next bitmap and the distances of its nodes
+            nextBits.assign(words, 0);
+            found = scheduler.parallel_reduce(nodeCount, BOTTOM_UP_GRAIN, LevelResult(), [&](std::size_t begin, std::size_t end) {
+                LevelResult part;
+                for (std::size_t node = begin; node < end; ++node) {
+                    if (distance[node].load(std::memory_order_relaxed) != UNREACHED) {
+                        continue;
+                    }
+                    for (std::size_t edge = graph.offsets[node]; edge < graph.offsets[node + 1]; ++edge) {
+                        std::uint32_t next = graph.neighbors[edge];
+                        if (frontierBits[next / 64] & (std::uint64_t(1) << (next % 64))) {
+                            distance[node].store(level, std::memory_order_relaxed);
+                            nextBits[node / 64] |= std::uint64_t(1) << (node % 64);
+                            ++part.count;
+                            part.edges += degree(static_cast<std::uint32_t>(node));
+                            break;
+                        }
+                    }
+                }
+                return part;
+            }, combineLevels);
+            frontierBits.swap(nextBits);
+        }
+
+        frontierSize = found.count;
+        frontierEdges = found.edges;
+        unreachedEdges -= frontierEdges;
+    }
+
+    std::vector<std::uint32_t> hops(nodeCount);
+    for (std::size_t node = 0; node < nodeCount; ++node) {
+        hops[node] = distance[node].load(std::memory_order_relaxed);
+    }
+    return hops;
+}
+}
+
 // Modify the code below to implement the functionality of the class.
 // Also remove comments from the parameter names when you implement
 // an operation (Commenting out parameter name prevents compiler from
@@ -36,30 +315,323 @@ Datastructures::~Datastructures()
     // Write any cleanup you need here
 }
 
-unsigned int Datastructures::get_affiliation_count()
+unsigned int Datastructures::get_affiliation_count() const
 {
+    if (image_) {
+        return image_->get_affiliation_count();
+    }
+
     return affiliationsMapContainer_.size();
 }
 
 void Datastructures::clear_all()
 {
-    //clear(): Removes all elements from the vector (which are destroyed), leaving the container with a size of 0.
-    affiliationsMapContainer_.clear();
-    publicationsMapContainer_.clear();
-
-    // Define a flag to check if the data has been sorted
-    affiliationsSortedFlag = false;
-    distancesSortedFlag = false;
+    clearData();
 
+    if (wal_ && !wal_->clear_all()) {
+        walFailed_ = true;
+    }
+}
 
-    // Create a vector of pairs to hold affiliation names and IDs
+void Datastructures::clearData()
+{
+    image_.reset();
+    invalidateConnectionGraph();
+    logPosition_ = 0;
+
+    // Replace the containers so that nothing points into the pools anymore, then
+    // return all of their memory to the system
+    affiliationsMapContainer_ = decltype(affiliationsMapContainer_)(&affiliationMemory_);
+    publicationsMapContainer_ = decltype(publicationsMapContainer_)(&publicationMemory_);
+    affiliationPool_.release();
+    publicationPool_.release();
+
+    // Empty the name, coordinate and distance indices
     nameIDPairs.clear();
     coordIDMap.clear();
     distanceIDMap.clear();
     connectionsMap.clear();
+
+    // Reset the reference forest index
+    slotPublication_.clear();
+    slotParent_.clear();
+    slotJump_.clear();
+    slotDepth_.clear();
+    freeSlots_.clear();
+    tokenNext_.clear();
+    tokenPrev_.clear();
+    tokenLabel_.clear();
+    tokenHead_ = NO_TOKEN;
+    tokenTail_ = NO_TOKEN;
+    slotSize_.clear();
+    citationIndex_.clear();
+
+    // Records collected for a bulk load are gone as well
+    bulkAffiliations_.clear();
+    bulkReferences_.clear();
+}
+
+void Datastructures::begin_bulk_load()
+{
+    // The log marks where bulk loads start and end so that replay takes the same path
+    if (wal_ && !bulkLoading_ && !wal_->begin_bulk_load()) {
+        walFailed_ = true;
+    }
+    bulkLoading_ = true;
+}
+
+void Datastructures::end_bulk_load()
+{
+    if (!bulkLoading_) {
+        return;
+    }
+    bulkLoading_ = false;
+    invalidateConnectionGraph();
+    if (wal_ && !wal_->end_bulk_load()) {
+        walFailed_ = true;
+    }
+
+    // The three groups of indices share no data, so they are built side by side.
+    // Only the reference forest allocates from the publication pool.
+    Scheduler::instance().parallel_invoke({
+        [this]() { buildAffiliationIndices(); },
+        [this]() { buildConnections(); },
+        [this]() { buildReferenceForest(); },
+    });
+
+    bulkAffiliations_ = {};
+    bulkReferences_ = {};
+}
+
+bool Datastructures::save_snapshot(std::ostream& output)
+{
+    if (image_) {
+        return false; // Images are already saved
+    }
+
+    // The snapshot stores the built connections
+    end_bulk_load();
+
+    SnapshotWriter payload;
+    payload.put<std::uint64_t>(affiliationsMapContainer_.size());
+    for (const auto& entry : affiliationsMapContainer_) {
+        const Affiliation& affiliation = entry.second;
+        payload.put(affiliation.id);
+        payload.put(affiliation.name);
+        payload.put(affiliation.coord.x);
+        payload.put(affiliation.coord.y);
+        payload.put<std::uint64_t>(affiliation.publications_produced.size());
+        for (PublicationID publicationid : affiliation.publications_produced) {
+            payload.put(publicationid);
+        }
+    }
+
+    payload.put<std::uint64_t>(publicationsMapContainer_.size());
+    for (const auto& entry : publicationsMapContainer_) {
+        const Publication& publication = entry.second;
+        payload.put(publication.id);
+        payload.put(publication.title);
+        payload.put(publication.publicationYear);
+        payload.put<std::uint64_t>(publication.affiliations_produced.size());
+        for (const AffiliationID& affiliationid : publication.affiliations_produced) {
+            payload.put(affiliationid);
+        }
+        payload.put(publication.publication_referenced_by);
+        payload.put<std::uint64_t>(publication.publications_reference_to.size());
+        for (PublicationID referenceid : publication.publications_reference_to) {
+            payload.put(referenceid);
+        }
+    }
+
+    payload.put<std::uint64_t>(connectionsMap.size());
+    for (const auto& entry : connectionsMap) {
+        payload.put(entry.first);
+        payload.put<std::uint64_t>(entry.second.size());
+        for (const Connection& connection : entry.second) {
+            payload.put(connection.aff1);
+            payload.put(connection.aff2);
+            payload.put(connection.weight);
+        }
+    }
+
+    SnapshotWriter header;
+    header.data.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.put(SNAPSHOT_VERSION);
+    header.put(SNAPSHOT_BYTE_ORDER);
+    header.put<std::uint64_t>(payload.data.size());
+    header.put(fnv1a(payload.data));
+    // The log records up to here are in the snapshot, replay on top of it starts after them.
+    // The snapshot can't point past what the log file really holds.
+    if (wal_ && !wal_->sync()) {
+        walFailed_ = true;
+        return false;
+    }
+    header.put<std::uint64_t>(wal_ ? wal_->position() : logPosition_);
+
+    output.write(header.data.data(), header.data.size());
+    output.write(payload.data.data(), payload.data.size());
+    return static_cast<bool>(output);
+}
+
+bool Datastructures::load_snapshot(std::istream& input)
+{
+    // The whole file is checked before anything is replaced
+    std::string headerData(SNAPSHOT_HEADER_SIZE, '\0');
+    if (!input.read(&headerData[0], headerData.size()) ||
+        headerData.compare(0, sizeof(SNAPSHOT_MAGIC), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return false;
+    }
+
+    SnapshotReader header{headerData, sizeof(SNAPSHOT_MAGIC)};
+    std::uint32_t version = 0;
+    std::uint32_t byteOrder = 0;
+    std::uint64_t size = 0;
+    std::uint64_t checksum = 0;
+    std::uint64_t position = 0;
+    header.get(version);
+    header.get(byteOrder);
+    header.get(size);
+    header.get(checksum);
+    header.get(position);
+    if (version != SNAPSHOT_VERSION || byteOrder != SNAPSHOT_BYTE_ORDER) {
+        return false;
+    }
+
+    std::string payloadData;
+    if (!readPayload(input, size, payloadData) || fnv1a(payloadData) != checksum) {
+        return false;
+    }
+
+    // Records go in the same way as in a bulk load, a record that doesn't parse leaves the data empty.
+    // An open log followed the data being replaced, so it is closed.
+    close_wal();
+    clearData();
+    bulkLoading_ = true;
+    auto fail = [this]() {
+        bulkLoading_ = false;
+        clearData();
+        return false;
+    };
+
+    SnapshotReader payload{payloadData};
+    std::uint64_t count = 0;
+    if (!payload.get(count) || !payload.fits(count)) { return fail(); }
+    affiliationsMapContainer_.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i) {
+        AffiliationID id;
+        Name name;
+        Coord xy;
+        std::uint64_t publicationCount = 0;
+        if (!payload.get(id) || !payload.get(name) || !payload.get(xy.x) || !payload.get(xy.y) || !payload.get(publicationCount) ||
+            !payload.fits(publicationCount)) {
+            return fail();
+        }
+
+        auto [it, inserted] = affiliationsMapContainer_.try_emplace(id, id, std::move(name), xy);
+        if (!inserted) { return fail(); }
+        bulkAffiliations_.push_back(&it->second);
+
+        auto& publications = it->second.publications_produced;
+        publications.resize(publicationCount);
+        for (std::uint64_t j = 0; j < publicationCount; ++j) {
+            if (!payload.get(publications[j])) { return fail(); }
+        }
+    }
+
+    if (!payload.get(count) || !payload.fits(count)) { return fail(); }
+    publicationsMapContainer_.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i) {
+        PublicationID id = 0;
+        Name title;
+        Year year = 0;
+        std::uint64_t affiliationCount = 0;
+        if (!payload.get(id) || !payload.get(title) || !payload.get(year) || !payload.get(affiliationCount) ||
+            !payload.fits(affiliationCount)) {
+            return fail();
+        }
+
+        std::vector<AffiliationID> affiliations(affiliationCount);
+        for (std::uint64_t j = 0; j < affiliationCount; ++j) {
+            if (!payload.get(affiliations[j])) { return fail(); }
+        }
+
+        auto [it, inserted] = publicationsMapContainer_.try_emplace(id, id, std::move(title), year, std::move(affiliations));
+        if (!inserted) { return fail(); }
+        it->second.slot = allocateSlot(id);
+
+        std::uint64_t referenceCount = 0;
+        if (!payload.get(it->second.publication_referenced_by) || !payload.get(referenceCount) || !payload.fits(referenceCount)) {
+            return fail();
+        }
+        auto& references = it->second.publications_reference_to;
+        references.resize(referenceCount);
+        for (std::uint64_t j = 0; j < referenceCount; ++j) {
+            if (!payload.get(references[j])) { return fail(); }
+        }
+    }
+
+    if (!payload.get(count) || !payload.fits(count)) { return fail(); }
+    connectionsMap.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i) {
+        AffiliationID id;
+        std::uint64_t connectionCount = 0;
+        if (!payload.get(id) || !payload.get(connectionCount) || !payload.fits(connectionCount)) { return fail(); }
+
+        Path& connections = connectionsMap[id];
+        connections.resize(connectionCount);
+        for (Connection& connection : connections) {
+            if (!payload.get(connection.aff1) || !payload.get(connection.aff2) || !payload.get(connection.weight)) {
+                return fail();
+            }
+        }
+    }
+
+    if (payload.pos != payloadData.size()) { return fail(); }
+
+    // A good checksum only means the file is what was written. Before the indices are
+    // built from them, the references have to name loaded publications and both ends
+    // of every reference have to agree.
+    std::size_t parentLinks = 0;
+    std::size_t referenceLinks = 0;
+    for (const auto& entry : publicationsMapContainer_) {
+        const Publication& publication = entry.second;
+        PublicationID parentid = publication.publication_referenced_by;
+        if (parentid != NO_PUBLICATION) {
+            if (parentid == entry.first || publicationsMapContainer_.count(parentid) == 0) { return fail(); }
+            ++parentLinks;
+        }
+        for (PublicationID referenceid : publication.publications_reference_to) {
+            auto referenceIt = publicationsMapContainer_.find(referenceid);
+            if (referenceIt == publicationsMapContainer_.end() || referenceIt->second.publication_referenced_by != entry.first) {
+                return fail();
+            }
+        }
+        referenceLinks += publication.publications_reference_to.size();
+    }
+    if (parentLinks != referenceLinks) { return fail(); }
+    for (const auto& entry : affiliationsMapContainer_) {
+        for (PublicationID publicationid : entry.second.publications_produced) {
+            if (publicationsMapContainer_.count(publicationid) == 0) { return fail(); }
+        }
+    }
+
+    // Connections come from the file, the other indices are built like after a bulk load
+    bulkLoading_ = false;
+    Scheduler::instance().parallel_invoke({
+        [this]() { buildAffiliationIndices(); },
+        [this]() { buildReferenceForest(); },
+    });
+    bulkAffiliations_ = {};
+
+    logPosition_ = position;
+    return true;
 }
 
-std::vector<AffiliationID> Datastructures::get_all_affiliations() {
+std::vector<AffiliationID> Datastructures::get_all_affiliations() const {
+    if (image_) {
+        return image_->get_all_affiliations();
+    }
+
     std::vector<AffiliationID> allAffiliations;
     allAffiliations.reserve(affiliationsMapContainer_.size()); // Reserve space for efficiency
 
@@ -74,15 +646,39 @@ std::vector<AffiliationID> Datastructures::get_all_affiliations() {
 
 bool Datastructures::add_affiliation(AffiliationID id, const Name &name, Coord xy)
 {
-    if (affiliationsMapContainer_.find(id) != affiliationsMapContainer_.end()) {
+    return addAffiliation(std::move(id), name, xy);
+}
+
+bool Datastructures::add_affiliation(AffiliationID id, Name &&name, Coord xy)
+{
+    return addAffiliation(std::move(id), std::move(name), xy);
+}
+
+template <typename NameArg>
+bool Datastructures::addAffiliation(AffiliationID&& id, NameArg&& name, Coord xy)
+{
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
+    // Construct the affiliation directly in its map node, nothing is built if the ID already exists
+    auto [it, inserted] = affiliationsMapContainer_.try_emplace(id, id, std::forward<NameArg>(name), xy);
+    if (!inserted) {
         return false; // ID already exists, return false
     }
+    invalidateConnectionGraph();
+
+    if (wal_ && !wal_->add_affiliation(it->second.id, it->second.name, xy)) {
+        walFailed_ = true;
+    }
 
-    Affiliation new_affiliation(id, name, xy);
-    affiliationsMapContainer_[id] = new_affiliation;
+    if (bulkLoading_) {
+        bulkAffiliations_.push_back(&it->second);
+        return true; // Indices are built by end_bulk_load
+    }
 
-    // Add name and ID as a pair to the nameIDPairs vector
-    nameIDPairs.push_back(std::make_pair(name, id));
+    // Add name and ID as a pair to the name order
+    nameIDPairs.emplace(it->second.name, id);
 
     // Update coordIDMap with the new affiliation
     coordIDMap[xy] = id; // Insert into coordIDMap using coordinates (xy) as key
@@ -90,17 +686,18 @@ bool Datastructures::add_affiliation(AffiliationID id, const Name &name, Coord x
     // Calculate distance between the new affiliation's coordinates and origin (0, 0)
     double distance = std::sqrt(xy.x * xy.x + xy.y * xy.y);
 
-    // Store the distance along with the ID in the distanceIDMap vector
-    distanceIDMap.push_back(std::make_pair(distance, id));
-
-    affiliationsSortedFlag = false;
-    distancesSortedFlag = false;
+    // Store the distance along with the ID in the distance order
+    distanceIDMap.insert({distance, xy.y, std::move(id)});
 
     return true; // Affiliation added successfully
 }
 
-Name Datastructures::get_affiliation_name(AffiliationID id)
+Name Datastructures::get_affiliation_name(AffiliationID id) const
 {
+    if (image_) {
+        return image_->get_affiliation_name(id);
+    }
+
     // Check if an affiliation with the given ID exists
     auto it = affiliationsMapContainer_.find(id);
     if (it != affiliationsMapContainer_.end()) {
@@ -110,8 +707,12 @@ Name Datastructures::get_affiliation_name(AffiliationID id)
     return NO_NAME; // Return NO_NAME if the affiliation doesn't exist
 }
 
-Coord Datastructures::get_affiliation_coord(AffiliationID id)
+Coord Datastructures::get_affiliation_coord(AffiliationID id) const
 {
+    if (image_) {
+        return image_->get_affiliation_coord(id);
+    }
+
     // Check if an affiliation with the given ID exists
     auto it = affiliationsMapContainer_.find(id);
     if (it != affiliationsMapContainer_.end()) {
@@ -121,12 +722,9 @@ Coord Datastructures::get_affiliation_coord(AffiliationID id)
     return NO_COORD; // Return NO_NAME if the affiliation doesn't exist
 }
 
-std::vector<AffiliationID> Datastructures::get_affiliations_alphabetically() {
-    if (!affiliationsSortedFlag) {
-        // Sort the affiliations only if they have not been sorted before
-        std::sort(nameIDPairs.begin(), nameIDPairs.end());
-
-        affiliationsSortedFlag = true; // Update the flag to indicate sorting has been done
+std::vector<AffiliationID> Datastructures::get_affiliations_alphabetically() const {
+    if (image_) {
+        return image_->get_affiliations_alphabetically();
     }
 
     // Extract sorted IDs
@@ -140,33 +738,27 @@ std::vector<AffiliationID> Datastructures::get_affiliations_alphabetically() {
     return sortedIDs;
 }
 
-std::vector<AffiliationID> Datastructures::get_affiliations_distance_increasing() {
-    if (!distancesSortedFlag) {
-        // Sort the affiliations only if they have not been sorted before
-        std::sort(distanceIDMap.begin(), distanceIDMap.end(), [&](const auto& a, const auto& b) {
-            // Compare distances first
-            if (std::abs(a.first - b.first) < 1e-9) { // Check if distances are approximately equal
-                // If distances are the same, smaller y-value comes first
-                return affiliationsMapContainer_[a.second].coord.y < affiliationsMapContainer_[b.second].coord.y;
-            }
-            return a.first < b.first; // Sort based on distance if not equal
-        });
-
-        distancesSortedFlag = true; // Update the flag to indicate sorting has been done
+std::vector<AffiliationID> Datastructures::get_affiliations_distance_increasing() const {
+    if (image_) {
+        return image_->get_affiliations_distance_increasing();
     }
 
     // Extract sorted IDs
     std::vector<AffiliationID> sortedIDs;
     sortedIDs.reserve(distanceIDMap.size());
 
-    for (const auto& pair : distanceIDMap) {
-        sortedIDs.push_back(pair.second);
+    for (const auto& entry : distanceIDMap) {
+        sortedIDs.push_back(entry.id);
     }
 
     return sortedIDs;
 }
 
-AffiliationID Datastructures::find_affiliation_with_coord(Coord xy) {
+AffiliationID Datastructures::find_affiliation_with_coord(Coord xy) const {
+    if (image_) {
+        return image_->find_affiliation_with_coord(xy);
+    }
+
     auto it = coordIDMap.find(xy); // Using find directly for lookup
 
     if (it != coordIDMap.end()) {
@@ -178,9 +770,17 @@ AffiliationID Datastructures::find_affiliation_with_coord(Coord xy) {
 
 bool Datastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
 {
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
+    // Moving an affiliation updates the coordinate and distance indices, so they have to be built first
+    end_bulk_load();
+
     auto it = affiliationsMapContainer_.find(id);
 
     if (it != affiliationsMapContainer_.end()) {
+        Coord oldcoord = it->second.coord;
         it->second.coord = newcoord;
 
         for (auto it = coordIDMap.begin(); it != coordIDMap.end(); ) {
@@ -194,15 +794,13 @@ bool Datastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
         }
 
 
-        // Recalculate distances and update distanceIDMap
-        for (auto& pair : distanceIDMap) {
-            if (pair.second == id) {
-                double distance = std::sqrt(newcoord.x * newcoord.x + newcoord.y * newcoord.y);
-                pair.first = distance;
-            }
-        }
+        // Move the affiliation to its new place in the distance order
+        distanceIDMap.erase({std::sqrt(oldcoord.x * oldcoord.x + oldcoord.y * oldcoord.y), oldcoord.y, id});
+        distanceIDMap.insert({std::sqrt(newcoord.x * newcoord.x + newcoord.y * newcoord.y), newcoord.y, id});
 
-        distancesSortedFlag = false; // Update the flag to indicate distances are not sorted
+        if (wal_ && !wal_->change_affiliation_coord(id, newcoord)) {
+            walFailed_ = true;
+        }
         return true;
     }
 
@@ -211,13 +809,36 @@ bool Datastructures::change_affiliation_coord(AffiliationID id, Coord newcoord)
 
 bool Datastructures::add_publication(PublicationID id, const Name &name, Year year, const std::vector<AffiliationID>& affiliations)
 {
-    // Check if the publication with the given ID exists
-    if (publicationsMapContainer_.find(id) != publicationsMapContainer_.end()) {
+    return addPublication(id, name, year, affiliations);
+}
+
+bool Datastructures::add_publication(PublicationID id, Name &&name, Year year, std::vector<AffiliationID>&& affiliations)
+{
+    return addPublication(id, std::move(name), year, std::move(affiliations));
+}
+
+template <typename NameArg, typename AffiliationsArg>
+bool Datastructures::addPublication(PublicationID id, NameArg&& name, Year year, AffiliationsArg&& affiliationsArg)
+{
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
+    // Construct the publication directly in its map node, nothing is built if the ID already exists
+    auto [it, inserted] = publicationsMapContainer_.try_emplace(id, id, std::forward<NameArg>(name), year,
+                                                                std::forward<AffiliationsArg>(affiliationsArg));
+    if (!inserted) {
         return false; // Publication with the same ID already exists
     }
+    invalidateConnectionGraph();
+    it->second.slot = allocateSlot(id);
 
-    // Create a new publication object
-    Publication new_publication(id, name, year, affiliations);
+    // The arguments may have been moved from, the publication holds the affiliations now
+    const auto& affiliations = it->second.affiliations_produced;
+
+    if (wal_ && !wal_->add_publication(id, it->second.title, year, affiliations)) {
+        walFailed_ = true;
+    }
 
     // Update the references for the affiliations
     for (const AffiliationID& affiliationID : affiliations) {
@@ -227,14 +848,15 @@ bool Datastructures::add_publication(PublicationID id, const Name &name, Year ye
         }
     }
 
-    // Add the new publication to the container
-    publicationsMapContainer_[id] = new_publication;
+    if (bulkLoading_) {
+        return true; // Connections are built by end_bulk_load
+    }
 
     // Update connections between affiliations based on the new publication
     for (size_t i = 0; i < affiliations.size(); ++i) {
         for (size_t j = i + 1; j < affiliations.size(); ++j) {
-            AffiliationID aff1 = affiliations[i];
-            AffiliationID aff2 = affiliations[j];
+            const AffiliationID& aff1 = affiliations[i];
+            const AffiliationID& aff2 = affiliations[j];
 
             // Check if a connection already exists between these affiliations
             bool connection_exists = false;
@@ -283,8 +905,12 @@ bool Datastructures::add_publication(PublicationID id, const Name &name, Year ye
     return true;
 }
 
-std::vector<PublicationID> Datastructures::all_publications()
+std::vector<PublicationID> Datastructures::all_publications() const
 {
+    if (image_) {
+        return image_->all_publications();
+    }
+
     std::vector<PublicationID> allPublications;
     for (const auto& entry : publicationsMapContainer_) {
         allPublications.push_back(entry.first);
@@ -292,8 +918,12 @@ std::vector<PublicationID> Datastructures::all_publications()
     return allPublications;
 }
 
-Name Datastructures::get_publication_name(PublicationID id)
+Name Datastructures::get_publication_name(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_publication_name(id);
+    }
+
     // Check if an affiliation with the given ID exists
     auto it = publicationsMapContainer_.find(id);
     if (it != publicationsMapContainer_.end()) {
@@ -303,8 +933,12 @@ Name Datastructures::get_publication_name(PublicationID id)
     return NO_NAME; // Return NO_NAME if the affiliation doesn't exist
 }
 
-Year Datastructures::get_publication_year(PublicationID id)
+Year Datastructures::get_publication_year(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_publication_year(id);
+    }
+
     // Check if an publicarion with the given ID exists
     auto it = publicationsMapContainer_.find(id);
     if (it != publicationsMapContainer_.end()) {
@@ -314,12 +948,17 @@ Year Datastructures::get_publication_year(PublicationID id)
     return NO_YEAR; // Return NO_NAME if the affiliation doesn't exist
 }
 
-std::vector<AffiliationID> Datastructures::get_affiliations(PublicationID id)
+std::vector<AffiliationID> Datastructures::get_affiliations(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_affiliations(id);
+    }
+
     // Check if an publicarion with the given ID exists
     auto it = publicationsMapContainer_.find(id);
     if (it != publicationsMapContainer_.end()) {
-        return it->second.affiliations_produced; // Return the name of the affiliation
+        const auto& affiliations = it->second.affiliations_produced;
+        return {affiliations.begin(), affiliations.end()};
     }
 
     return {NO_AFFILIATION};
@@ -327,26 +966,66 @@ std::vector<AffiliationID> Datastructures::get_affiliations(PublicationID id)
 
 bool Datastructures::add_reference(PublicationID id, PublicationID parentid)
 {
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
     auto it_childid = publicationsMapContainer_.find(id);
     auto it_parentid = publicationsMapContainer_.find(parentid);
 
     if (it_childid != publicationsMapContainer_.end() && it_parentid != publicationsMapContainer_.end()) {
 
+        if (bulkLoading_) {
+            // Cycles show up only once the whole forest is known, end_bulk_load drops them
+            bulkReferences_.emplace_back(id, parentid);
+            if (wal_ && !wal_->add_reference(id, parentid)) {
+                walFailed_ = true;
+            }
+            return true;
+        }
+
+        Slot child = it_childid->second.slot;
+        Slot parent = it_parentid->second.slot;
+
+        // Refuse references that would turn the forest into a cycle
+        if (isInSubtree(parent, child)) {
+            return false;
+        }
+
+        // A publication is referenced by at most one publication, so detach it from the old one
+        PublicationID old_parentid = it_childid->second.publication_referenced_by;
+        auto it_old_parent = publicationsMapContainer_.find(old_parentid);
+        if (old_parentid != NO_PUBLICATION && it_old_parent != publicationsMapContainer_.end()) {
+            auto& references = it_old_parent->second.publications_reference_to;
+            references.erase(std::remove(references.begin(), references.end(), id), references.end());
+        }
+
         it_parentid->second.publications_reference_to.push_back(id);
         it_childid->second.publication_referenced_by = parentid;
 
+        moveSubtree(child, parent);
+
+        if (wal_ && !wal_->add_reference(id, parentid)) {
+            walFailed_ = true;
+        }
+
         return true;
     }
 
     return false;
 }
 
-std::vector<PublicationID> Datastructures::get_direct_references(PublicationID id)
+std::vector<PublicationID> Datastructures::get_direct_references(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_direct_references(id);
+    }
+
     // Check if an publicarion with the given ID exists
     auto it = publicationsMapContainer_.find(id);
     if (it != publicationsMapContainer_.end()) {
-        return it->second.publications_reference_to; // Return the name of the affiliation
+        const auto& references = it->second.publications_reference_to;
+        return {references.begin(), references.end()};
     }
 
     return {NO_PUBLICATION};
@@ -354,16 +1033,29 @@ std::vector<PublicationID> Datastructures::get_direct_references(PublicationID i
 
 bool Datastructures::add_affiliation_to_publication(AffiliationID affiliationid, PublicationID publicationid)
 {
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
     auto it_affiliation = affiliationsMapContainer_.find(affiliationid);
     auto it_publication = publicationsMapContainer_.find(publicationid);
 
     if (it_affiliation != affiliationsMapContainer_.end() && it_publication != publicationsMapContainer_.end()) {
+        invalidateConnectionGraph();
 
         it_affiliation->second.publications_produced.push_back(publicationid);
         it_publication->second.affiliations_produced.push_back(affiliationid);
 
+        if (wal_ && !wal_->add_affiliation_to_publication(affiliationid, publicationid)) {
+            walFailed_ = true;
+        }
+
+        if (bulkLoading_) {
+            return true; // Connections are built by end_bulk_load
+        }
+
         // Update connection map based on shared publications
-         const std::vector<AffiliationID>& affiliations = it_publication->second.affiliations_produced;
+         const auto& affiliations = it_publication->second.affiliations_produced;
          for (size_t i = 0; i < affiliations.size(); ++i) {
              for (size_t j = i + 1; j < affiliations.size(); ++j) {
                  AffiliationID aff1 = affiliations[i];
@@ -425,19 +1117,28 @@ bool Datastructures::add_affiliation_to_publication(AffiliationID affiliationid,
     return false;
 }
 
-std::vector<PublicationID> Datastructures::get_publications(AffiliationID id)
+std::vector<PublicationID> Datastructures::get_publications(AffiliationID id) const
 {
+    if (image_) {
+        return image_->get_publications(id);
+    }
+
     // Check if an publicarion with the given ID exists
     auto it = affiliationsMapContainer_.find(id);
     if (it != affiliationsMapContainer_.end()) {
-        return it->second.publications_produced; // Return the name of the affiliation
+        const auto& publications = it->second.publications_produced;
+        return {publications.begin(), publications.end()};
     }
 
     return {NO_PUBLICATION};
 }
 
-PublicationID Datastructures::get_parent(PublicationID id)
+PublicationID Datastructures::get_parent(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_parent(id);
+    }
+
     // Check if a publication with the given ID exists
     auto it = publicationsMapContainer_.find(id);
     if (it != publicationsMapContainer_.end()) {
@@ -456,21 +1157,27 @@ PublicationID Datastructures::get_parent(PublicationID id)
     return NO_PUBLICATION;
 }
 
-std::vector<std::pair<Year, PublicationID>> Datastructures::get_publications_after(AffiliationID affiliationid, Year year)
+std::vector<std::pair<Year, PublicationID>> Datastructures::get_publications_after(AffiliationID affiliationid, Year year) const
 {
+    if (image_) {
+        return image_->get_publications_after(affiliationid, year);
+    }
+
     std::vector<std::pair<Year, PublicationID>> result;
 
     // Check if the affiliation with the given ID exists in affiliationsMapContainer_
-    if (affiliationsMapContainer_.find(affiliationid) != affiliationsMapContainer_.end())
+    auto affiliationIt = affiliationsMapContainer_.find(affiliationid);
+    if (affiliationIt != affiliationsMapContainer_.end())
     {
         // Iterate through the publications produced by the affiliation
-        const Affiliation& affiliation = affiliationsMapContainer_[affiliationid]; //get this affiliation
+        const Affiliation& affiliation = affiliationIt->second; //get this affiliation
         for (const PublicationID& publicationid : affiliation.publications_produced)
         {
             // Check if the publication with the given ID exists in publicationsMapContainer_
-            if (publicationsMapContainer_.find(publicationid) != publicationsMapContainer_.end())
+            auto publicationIt = publicationsMapContainer_.find(publicationid);
+            if (publicationIt != publicationsMapContainer_.end())
             {
-                const Publication& publication = publicationsMapContainer_[publicationid]; //get this publication
+                const Publication& publication = publicationIt->second; //get this publication
                 // Check if the publication's year is at or after the specified year
                 if (publication.publicationYear >= year)
                 {
@@ -496,35 +1203,25 @@ std::vector<std::pair<Year, PublicationID>> Datastructures::get_publications_aft
     return result;
 }
 
-std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID id)
+std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID id) const
 {
+    if (image_) {
+        return image_->get_referenced_by_chain(id);
+    }
+
     auto it = publicationsMapContainer_.find(id);
 
     if (it != publicationsMapContainer_.end())
     {
+        // The chain is exactly as long as the depth of the publication, the
+        // original publication itself is excluded from the result
+        Slot slot = it->second.slot;
         std::vector<PublicationID> result;
-        std::unordered_set<PublicationID> visited;
+        result.reserve(slotDepth_[slot]);
 
-        std::function<void(PublicationID)> dfs = [&](PublicationID current_id) {
-            visited.insert(current_id);
-
-            if (publicationsMapContainer_.find(current_id) != publicationsMapContainer_.end()) {
-                const Publication& publication = publicationsMapContainer_[current_id];
-
-                // Exclude the original publication from the result
-                if (current_id != id) {
-                    result.push_back(current_id);
-                }
-
-                // Check if there is a parent publication that references the current publication
-                PublicationID parent_id = publication.publication_referenced_by;
-                if (visited.find(parent_id) == visited.end() && parent_id != NO_PUBLICATION) {
-                    dfs(parent_id);
-                }
-            }
-        };
-
-        dfs(id);
+        for (Slot parent = slotParent_[slot]; parent != NO_SLOT; parent = slotParent_[parent]) {
+            result.push_back(slotPublication_[parent]);
+        }
 
         return result;
     }
@@ -532,24 +1229,135 @@ std::vector<PublicationID> Datastructures::get_referenced_by_chain(PublicationID
     return {NO_PUBLICATION};
 }
 
-std::vector<PublicationID> Datastructures::get_all_references(PublicationID id)
+PublicationID Datastructures::get_ancestor_at_depth(PublicationID id, unsigned int depth) const
 {
-    // Check if the publication with the given ID exists
-    auto it = publicationsMapContainer_.find(id);
-    if (it == publicationsMapContainer_.end())
-    {
-        // If the publication doesn't exist, return a vector with a single item NO_PUBLICATION
-        return {NO_PUBLICATION};
+    if (image_) {
+        return image_->get_ancestor_at_depth(id, depth);
     }
 
-    // If the publication exists, perform a DFS to find all references
+    auto it = publicationsMapContainer_.find(id);
+
+    // Depth 0 is the root of the reference tree, the publication itself is at its own depth
+    if (it == publicationsMapContainer_.end() || depth > slotDepth_[it->second.slot]) {
+        return NO_PUBLICATION;
+    }
+
+    return slotPublication_[ancestorAtDepth(it->second.slot, depth)];
+}
+
+std::vector<PublicationID> Datastructures::get_all_references(PublicationID id) const
+{
+    if (image_) {
+        return image_->get_all_references(id);
+    }
+
+    // Check if the publication with the given ID exists
+    auto it = publicationsMapContainer_.find(id);
+    if (it == publicationsMapContainer_.end())
+    {
+        // If the publication doesn't exist, return a vector with a single item NO_PUBLICATION
+        return {NO_PUBLICATION};
+    }
+
+    // Every reference opens a token between the publication's own open and close tokens
+    Slot slot = it->second.slot;
+    std::vector<PublicationID> result;
+    result.reserve(slotSize_[slot] - 1);
+
+    for (Token token = tokenNext_[2 * slot]; token != 2 * slot + 1; token = tokenNext_[token])
+    {
+        if (token % 2 == 0)
+        {
+            result.push_back(slotPublication_[token / 2]);
+        }
+    }
+    return result;
+}
+
+unsigned int Datastructures::count_all_references(PublicationID id) const
+{
+    if (image_) {
+        return image_->count_all_references(id);
+    }
+
+    auto it = publicationsMapContainer_.find(id);
+    if (it == publicationsMapContainer_.end())
+    {
+        return NO_COUNT;
+    }
+
+    // The subtree size includes the publication itself
+    return slotSize_[it->second.slot] - 1;
+}
+
+unsigned int Datastructures::get_citation_depth(PublicationID id) const
+{
+    if (image_) {
+        return image_->get_citation_depth(id);
+    }
+
+    auto it = publicationsMapContainer_.find(id);
+    if (it == publicationsMapContainer_.end())
+    {
+        return NO_COUNT;
+    }
+
+    return slotDepth_[it->second.slot];
+}
+
+unsigned int Datastructures::get_subtree_size(PublicationID id) const
+{
+    if (image_) {
+        return image_->get_subtree_size(id);
+    }
+
+    auto it = publicationsMapContainer_.find(id);
+    if (it == publicationsMapContainer_.end())
+    {
+        return NO_COUNT;
+    }
+
+    return slotSize_[it->second.slot];
+}
+
+std::vector<PublicationID> Datastructures::get_most_cited(unsigned int k) const
+{
+    if (image_) {
+        return image_->get_most_cited(k);
+    }
+
+    std::vector<PublicationID> result;
+    result.reserve(std::min<std::size_t>(k, citationIndex_.size()));
+
+    for (auto it = citationIndex_.begin(); it != citationIndex_.end() && result.size() < k; ++it)
+    {
+        result.push_back(it->second);
+    }
+    return result;
+}
+
+std::vector<PublicationID> Datastructures::get_all_references_dfs(PublicationID id) const
+{
+    if (image_) {
+        return image_->get_all_references(id);
+    }
+
+    // Check if the publication with the given ID exists
+    auto it = publicationsMapContainer_.find(id);
+    if (it == publicationsMapContainer_.end())
+    {
+        // If the publication doesn't exist, return a vector with a single item NO_PUBLICATION
+        return {NO_PUBLICATION};
+    }
+
+    // If the publication exists, perform a DFS to find all references
     std::vector<PublicationID> result;
     std::unordered_set<PublicationID> visited;
 
     // Perform a depth-first search to find publications that reference the given publication
     std::function<void(PublicationID)> dfs = [&](PublicationID current_id) {
         visited.insert(current_id);
-        const Publication& publication = publicationsMapContainer_[current_id];
+        const Publication& publication = publicationsMapContainer_.at(current_id);
 
         // Iterate through publications that reference the current publication
         for (PublicationID referenced_id : publication.publications_reference_to)
@@ -571,8 +1379,12 @@ std::vector<PublicationID> Datastructures::get_all_references(PublicationID id)
     return result;
 }
 
-std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy)
+std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy) const
 {
+    if (image_) {
+        return image_->get_affiliations_closest_to(xy);
+    }
+
     // Create a vector to store affiliation IDs
     std::vector<AffiliationID> affiliationIDs;
 
@@ -617,6 +1429,14 @@ std::vector<AffiliationID> Datastructures::get_affiliations_closest_to(Coord xy)
 
 bool Datastructures::remove_affiliation(AffiliationID id)
 {
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
+    // Removals update the indices, so they have to be built first
+    end_bulk_load();
+    invalidateConnectionGraph();
+
     // Check if the affiliation with the given ID exists
     auto it = affiliationsMapContainer_.find(id);
     if (it == affiliationsMapContainer_.end())
@@ -624,16 +1444,15 @@ bool Datastructures::remove_affiliation(AffiliationID id)
         return false; // Affiliation doesn't exist, return false
     }
 
-    // Affiliation exists, so remove it from affiliationsMapContainer_
+    // Affiliation exists, so remove it from the name and distance orders by key
+    // and then from affiliationsMapContainer_
+    Coord xy = it->second.coord;
+    nameIDPairs.erase({it->second.name, id});
+    distanceIDMap.erase({std::sqrt(xy.x * xy.x + xy.y * xy.y), xy.y, id});
     affiliationsMapContainer_.erase(it);
 
-    // Remove the affiliation from nameIDPairs
-    auto nameIDPairsIt = std::find_if(nameIDPairs.begin(), nameIDPairs.end(),
-        [id](const std::pair<std::string, AffiliationID>& pair) { return pair.second == id; });
-
-    if (nameIDPairsIt != nameIDPairs.end())
-    {
-        nameIDPairs.erase(nameIDPairsIt);
+    if (wal_ && !wal_->remove_affiliation(id)) {
+        walFailed_ = true;
     }
 
     // Remove the affiliation from coordIDMap
@@ -645,15 +1464,6 @@ bool Datastructures::remove_affiliation(AffiliationID id)
         coordIDMap.erase(coordIDMapIt);
     }
 
-    // Remove the affiliation from distanceIDMap
-    auto distanceIDMapIt = std::find_if(distanceIDMap.begin(), distanceIDMap.end(),
-        [id](const std::pair<double, AffiliationID>& pair) { return pair.second == id; });
-
-    if (distanceIDMapIt != distanceIDMap.end())
-    {
-        distanceIDMap.erase(distanceIDMapIt);
-    }
-
     // Remove connections related to the removed affiliation
     for (auto &connections : connectionsMap) {
         connections.second.erase(std::remove_if(connections.second.begin(), connections.second.end(),
@@ -678,8 +1488,12 @@ bool Datastructures::remove_affiliation(AffiliationID id)
     return true; // Affiliation removed successfully
 }
 
-PublicationID Datastructures::get_closest_common_parent(PublicationID id1, PublicationID id2)
+PublicationID Datastructures::get_closest_common_parent(PublicationID id1, PublicationID id2) const
 {
+    if (image_) {
+        return image_->get_closest_common_parent(id1, id2);
+    }
+
     // Check if the publications with the given IDs exist
     auto it1 = publicationsMapContainer_.find(id1);
     auto it2 = publicationsMapContainer_.find(id2);
@@ -689,28 +1503,31 @@ PublicationID Datastructures::get_closest_common_parent(PublicationID id1, Publi
         return NO_PUBLICATION;
     }
 
-    // Get the chains of publications that reference id1 and id2
-    std::vector<PublicationID> chain1 = get_referenced_by_chain(id1);
-    std::vector<PublicationID> chain2 = get_referenced_by_chain(id2);
+    // The answer is the lowest publication that references both of them, so when one of
+    // the publications is itself the common ancestor we step one level further up
+    Slot common = lowestCommonAncestor(it1->second.slot, it2->second.slot);
+    if (common != NO_SLOT && (common == it1->second.slot || common == it2->second.slot)) {
+        common = slotParent_[common];
+    }
 
-    // Find the closest common parent in the chains
-    PublicationID closest_common_parent = NO_PUBLICATION;
-    for (PublicationID parent1 : chain1) {
-        for (PublicationID parent2 : chain2) {
-            if (parent1 == parent2) {
-                // Found a common parent, update closest_common_parent
-                closest_common_parent = parent1;
-                return closest_common_parent;
-            }
-        }
+    if (common == NO_SLOT) {
+        // If there's no common parent, return NO_PUBLICATION
+        return NO_PUBLICATION;
     }
 
-    // If there's no common parent, return NO_PUBLICATION
-    return NO_PUBLICATION;
+    return slotPublication_[common];
 }
 
 bool Datastructures::remove_publication(PublicationID publicationid)
 {
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+
+    // Removals update the indices, so they have to be built first
+    end_bulk_load();
+    invalidateConnectionGraph();
+
     // Check if the publication with the given ID exists
     auto it = publicationsMapContainer_.find(publicationid);
 
@@ -719,37 +1536,41 @@ bool Datastructures::remove_publication(PublicationID publicationid)
         return false;
     }
 
-    // Remove the publication from publicationsMapContainer
+    // Take the publication out of the container before it is erased
+    Publication publication = std::move(it->second);
     publicationsMapContainer_.erase(it);
 
-    // Iterate through affiliations and remove the reference to the publication
-    for (auto& affiliation : affiliationsMapContainer_) {
-        auto& publications_produced = affiliation.second.publications_produced;
-        publications_produced.erase(std::remove(publications_produced.begin(), publications_produced.end(), publicationid), publications_produced.end());
+    if (wal_ && !wal_->remove_publication(publicationid)) {
+        walFailed_ = true;
     }
 
-    // Iterate through other publications and remove references
-    for (auto& publication : publicationsMapContainer_) {
-
-        // For this publication, if it is referenced by one publication (in its publication_referenced_by),
-        // remove publicationid from this publication's publication_referenced_by.
-        auto& references = publication.second.publications_reference_to;
+    // The publication referencing this one no longer lists it
+    auto parentIt = publicationsMapContainer_.find(publication.publication_referenced_by);
+    if (publication.publication_referenced_by != NO_PUBLICATION && parentIt != publicationsMapContainer_.end()) {
+        auto& references = parentIt->second.publications_reference_to;
         references.erase(std::remove(references.begin(), references.end(), publicationid), references.end());
+    }
 
-        // For this publication, if it references other publications (in its publications_reference_to vector),
-        // remove publicationid from each of these publications' PublicationID referenced_by.
-        if (publication.second.publication_referenced_by == publicationid) {
-            publication.second.publication_referenced_by = NO_PUBLICATION;
+    // Publications referenced by this one become roots of their own trees
+    for (PublicationID childid : publication.publications_reference_to) {
+        auto childIt = publicationsMapContainer_.find(childid);
+        if (childIt != publicationsMapContainer_.end()) {
+            childIt->second.publication_referenced_by = NO_PUBLICATION;
+            moveSubtree(childIt->second.slot, NO_SLOT);
         }
     }
+    releaseSlot(publication.slot);
 
     // Retrieve affiliations linked to this publication
-    auto& affiliations_produced = it->second.affiliations_produced;
+    auto& affiliations_produced = publication.affiliations_produced;
 
     // Iterate through affected affiliations and update connections or remove when weight is 0
     for (auto& affiliationID : affiliations_produced) {
-        auto& affiliation = affiliationsMapContainer_[affiliationID];
-        auto& publications_produced = affiliation.publications_produced;
+        auto affiliationIt = affiliationsMapContainer_.find(affiliationID);
+        if (affiliationIt == affiliationsMapContainer_.end()) {
+            continue;
+        }
+        auto& publications_produced = affiliationIt->second.publications_produced;
 
         publications_produced.erase(
             std::remove(publications_produced.begin(), publications_produced.end(), publicationid),
@@ -771,7 +1592,841 @@ bool Datastructures::remove_publication(PublicationID publicationid)
     return true;
 }
 
-Weight Datastructures::calculateWeight(AffiliationID id1, AffiliationID id2) {
+bool Datastructures::save_image(std::ostream& output)
+{
+    if (image_) {
+        return false; // Images are already saved
+    }
+
+    end_bulk_load();
+
+    // Nodes are all affiliation IDs met anywhere, sorted so that the image can binary search them
+    std::vector<std::string_view> ids;
+    ids.reserve(affiliationsMapContainer_.size() + connectionsMap.size());
+    for (const auto& entry : affiliationsMapContainer_) {
+        ids.push_back(entry.first);
+    }
+    for (const auto& entry : publicationsMapContainer_) {
+        ids.insert(ids.end(), entry.second.affiliations_produced.begin(), entry.second.affiliations_produced.end());
+    }
+    for (const auto& entry : connectionsMap) {
+        ids.push_back(entry.first);
+        for (const Connection& connection : entry.second) {
+            ids.push_back(connection.aff1);
+            ids.push_back(connection.aff2);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    std::unordered_map<std::string_view, std::uint32_t> nodeOf;
+    nodeOf.reserve(ids.size());
+    for (std::uint32_t node = 0; node < ids.size(); ++node) {
+        nodeOf.emplace(ids[node], node);
+    }
+
+    std::vector<PublicationID> publicationIDs;
+    publicationIDs.reserve(publicationsMapContainer_.size());
+    for (const auto& entry : publicationsMapContainer_) {
+        publicationIDs.push_back(entry.first);
+    }
+    std::sort(publicationIDs.begin(), publicationIDs.end());
+    std::unordered_map<PublicationID, std::uint32_t> publicationOf;
+    publicationOf.reserve(publicationIDs.size());
+    for (std::uint32_t publication = 0; publication < publicationIDs.size(); ++publication) {
+        publicationOf.emplace(publicationIDs[publication], publication);
+    }
+    auto publicationOfSlot = [&](Slot slot) {
+        return slot == NO_SLOT ? image::NONE : publicationOf.at(slotPublication_[slot]);
+    };
+
+    image::Builder builder;
+    builder.affiliationCount = affiliationsMapContainer_.size();
+    builder.nodes.reserve(ids.size());
+    for (std::string_view id : ids) {
+        image::Node node{};
+        AffiliationID affiliationid(id);
+        node.id = builder.addString(affiliationid);
+
+        auto it = affiliationsMapContainer_.find(affiliationid);
+        if (it != affiliationsMapContainer_.end()) {
+            node.exists = 1;
+            node.name = builder.addString(it->second.name);
+            node.x = it->second.coord.x;
+            node.y = it->second.coord.y;
+            node.publicationBegin = builder.nodePublications.size();
+            node.publicationCount = it->second.publications_produced.size();
+            for (PublicationID publicationid : it->second.publications_produced) {
+                builder.nodePublications.push_back(publicationOf.at(publicationid));
+            }
+        }
+
+        node.edgeBegin = builder.edges.size();
+        auto connections = connectionsMap.find(affiliationid);
+        if (connections != connectionsMap.end()) {
+            node.edgeCount = connections->second.size();
+            for (const Connection& connection : connections->second) {
+                const AffiliationID& other = (connection.aff1 == affiliationid) ? connection.aff2 : connection.aff1;
+                builder.edges.push_back({nodeOf.at(other), connection.weight});
+            }
+        }
+        builder.nodes.push_back(node);
+    }
+
+    builder.publications.reserve(publicationIDs.size());
+    for (PublicationID publicationid : publicationIDs) {
+        const Publication& publication = publicationsMapContainer_.find(publicationid)->second;
+        Slot slot = publication.slot;
+
+        image::Publication record{};
+        record.id = publicationid;
+        record.title = builder.addString(publication.title);
+        record.year = publication.publicationYear;
+        record.parent = publicationOfSlot(slotParent_[slot]);
+        record.jump = publicationOfSlot(slotJump_[slot]);
+        record.depth = slotDepth_[slot];
+        record.size = slotSize_[slot];
+        record.affiliationBegin = builder.publicationNodes.size();
+        record.affiliationCount = publication.affiliations_produced.size();
+        for (const AffiliationID& affiliationid : publication.affiliations_produced) {
+            builder.publicationNodes.push_back(nodeOf.at(affiliationid));
+        }
+        record.referenceBegin = builder.publicationReferences.size();
+        record.referenceCount = publication.publications_reference_to.size();
+        for (PublicationID referenceid : publication.publications_reference_to) {
+            builder.publicationReferences.push_back(publicationOf.at(referenceid));
+        }
+        builder.publications.push_back(record);
+    }
+
+    // The open tokens of the Euler tour give the preorder, references of a publication follow it directly
+    builder.preorder.reserve(publicationIDs.size());
+    for (Token token = tokenHead_; token != NO_TOKEN; token = tokenNext_[token]) {
+        if (token % 2 == 0) {
+            std::uint32_t publication = publicationOfSlot(token / 2);
+            builder.publications[publication].preorder = builder.preorder.size();
+            builder.preorder.push_back(publication);
+        }
+    }
+
+    builder.nameOrder.reserve(nameIDPairs.size());
+    for (const auto& pair : nameIDPairs) {
+        builder.nameOrder.push_back(nodeOf.at(pair.second));
+    }
+    builder.distanceOrder.reserve(distanceIDMap.size());
+    for (const auto& entry : distanceIDMap) {
+        builder.distanceOrder.push_back(nodeOf.at(entry.id));
+    }
+    builder.coordIndex.reserve(coordIDMap.size());
+    for (const auto& pair : coordIDMap) {
+        builder.coordIndex.push_back({pair.first.x, pair.first.y, nodeOf.at(pair.second), 0});
+    }
+    std::sort(builder.coordIndex.begin(), builder.coordIndex.end(), [](const image::CoordEntry& a, const image::CoordEntry& b) {
+        return Coord{a.x, a.y} < Coord{b.x, b.y};
+    });
+    builder.citationOrder.reserve(citationIndex_.size());
+    for (const auto& citation : citationIndex_) {
+        builder.citationOrder.push_back(publicationOf.at(citation.second));
+    }
+
+    return builder.write(output);
+}
+
+bool Datastructures::open_image(const std::string& filename)
+{
+    std::unique_ptr<MappedImage> opened = MappedImage::open(filename);
+    if (!opened) {
+        return false;
+    }
+
+    // The log can't follow a read-only image
+    wal_.reset();
+    clearData();
+    image_ = std::move(opened);
+    return true;
+}
+
+void Datastructures::close_image()
+{
+    image_.reset();
+    invalidateConnectionGraph();
+}
+
+bool Datastructures::open_wal(const std::string& filename, unsigned int syncEvery)
+{
+    if (image_) {
+        return false; // The mapped image is read-only
+    }
+    close_wal();
+
+    // A missing file is an empty log
+    std::string data;
+    std::ifstream file(filename, std::ios::binary);
+    if (file) {
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        file.close();
+    }
+
+    std::uint64_t validSize = 0;
+    if (!replayLog(data, validSize)) {
+        return false;
+    }
+
+    wal_ = WriteAheadLog::open(filename, validSize, syncEvery);
+    return wal_ != nullptr;
+}
+
+bool Datastructures::replayLog(const std::string& data, std::uint64_t& validSize)
+{
+    // The records go through the same operations as when they were logged, bulk loads
+    // included, so the result is the same. wal_ is not open yet so nothing is logged twice.
+    // Records the data already holds are skipped, and a record whose operation fails
+    // (say, one already applied by hand) is passed over; only a record that doesn't parse stops the replay.
+    LogReader reader(data);
+    bool ok = true;
+    while (ok && reader.next()) {
+        if (reader.valid_size() <= logPosition_) {
+            continue;
+        }
+
+        std::uint64_t id = 0;
+        std::uint64_t other = 0;
+        AffiliationID affiliationid;
+        Name name;
+        Coord xy = NO_COORD;
+
+        switch (reader.operation()) {
+        case LogOperation::ADD_AFFILIATION:
+            ok = reader.get(affiliationid) && reader.get(name) && reader.get(xy);
+            if (ok) {
+                add_affiliation(std::move(affiliationid), std::move(name), xy);
+            }
+            break;
+        case LogOperation::ADD_PUBLICATION: {
+            std::uint64_t year = 0;
+            std::uint64_t count = 0;
+            ok = reader.get(id) && reader.get(name) && reader.get(year) && reader.get(count);
+            std::vector<AffiliationID> affiliations;
+            for (std::uint64_t i = 0; ok && i < count; ++i) {
+                ok = reader.get(affiliationid);
+                affiliations.push_back(std::move(affiliationid));
+            }
+            if (ok) {
+                add_publication(id, std::move(name), static_cast<Year>(year), std::move(affiliations));
+            }
+            break;
+        }
+        case LogOperation::ADD_REFERENCE:
+            ok = reader.get(id) && reader.get(other);
+            if (ok) {
+                add_reference(id, other);
+            }
+            break;
+        case LogOperation::ADD_AFFILIATION_TO_PUBLICATION:
+            ok = reader.get(affiliationid) && reader.get(id);
+            if (ok) {
+                add_affiliation_to_publication(affiliationid, id);
+            }
+            break;
+        case LogOperation::CHANGE_AFFILIATION_COORD:
+            ok = reader.get(affiliationid) && reader.get(xy);
+            if (ok) {
+                change_affiliation_coord(affiliationid, xy);
+            }
+            break;
+        case LogOperation::REMOVE_AFFILIATION:
+            ok = reader.get(affiliationid);
+            if (ok) {
+                remove_affiliation(affiliationid);
+            }
+            break;
+        case LogOperation::REMOVE_PUBLICATION:
+            ok = reader.get(id);
+            if (ok) {
+                remove_publication(id);
+            }
+            break;
+        case LogOperation::CLEAR_ALL:
+            clear_all();
+            break;
+        case LogOperation::BEGIN_BULK_LOAD:
+            begin_bulk_load();
+            break;
+        case LogOperation::END_BULK_LOAD:
+            end_bulk_load();
+            break;
+        default:
+            ok = false;
+        }
+    }
+
+    // A log shorter than the part already in the data is not the log the data came from
+    validSize = reader.valid_size();
+    return ok && validSize >= logPosition_;
+}
+
+std::vector<MemoryUsage> Datastructures::memory_usage() const
+{
+    // Containers with a counting resource report their nodes, buckets and pooled
+    // vectors, the strings in them use the default allocator and are added here
+    std::size_t affiliationBytes = affiliationMemory_.bytes();
+    for (const auto& [id, affiliation] : affiliationsMapContainer_) {
+        affiliationBytes += heapBytes(id) + heapBytes(affiliation.id) + heapBytes(affiliation.name);
+    }
+
+    std::size_t publicationBytes = publicationMemory_.bytes();
+    for (const auto& [id, publication] : publicationsMapContainer_) {
+        publicationBytes += heapBytes(publication.title);
+        for (const AffiliationID& affiliationid : publication.affiliations_produced) {
+            publicationBytes += heapBytes(affiliationid);
+        }
+    }
+
+    std::size_t connectionBytes = connectionsMemory_.bytes();
+    for (const auto& [id, connections] : connectionsMap) {
+        connectionBytes += heapBytes(id) + heapBytes(connections);
+        for (const Connection& connection : connections) {
+            connectionBytes += heapBytes(connection.aff1) + heapBytes(connection.aff2);
+        }
+    }
+
+    std::size_t nameBytes = nameMemory_.bytes();
+    for (const auto& [name, id] : nameIDPairs) {
+        nameBytes += heapBytes(name) + heapBytes(id);
+    }
+
+    std::size_t coordBytes = coordMemory_.bytes();
+    for (const auto& [xy, id] : coordIDMap) {
+        coordBytes += heapBytes(id);
+    }
+
+    std::size_t distanceBytes = distanceMemory_.bytes();
+    for (const auto& entry : distanceIDMap) {
+        distanceBytes += heapBytes(entry.id);
+    }
+
+    std::size_t forestBytes = heapBytes(slotPublication_) + heapBytes(slotParent_) + heapBytes(slotJump_) +
+                              heapBytes(slotDepth_) + heapBytes(freeSlots_) + heapBytes(tokenNext_) +
+                              heapBytes(tokenPrev_) + heapBytes(tokenLabel_) + heapBytes(slotSize_);
+
+    std::vector<MemoryUsage> usage = {
+        {"affiliationsMapContainer_", affiliationBytes, false},
+        {"publicationsMapContainer_", publicationBytes, true},
+        {"connectionsMap", connectionBytes, false},
+        {"nameIDPairs", nameBytes, false},
+        {"coordIDMap", coordBytes, false},
+        {"distanceIDMap", distanceBytes, false},
+        {"reference forest", forestBytes, true},
+        {"citationIndex_", citationMemory_.bytes(), true},
+    };
+    if (bulkLoading_) {
+        usage.push_back({"bulk load records", heapBytes(bulkAffiliations_) + heapBytes(bulkReferences_), true});
+    }
+    if (image_) {
+        usage.push_back({"mapped image", image_->mapped_bytes(), false});
+    }
+    if (auto graph = std::atomic_load(&connectionGraph_)) {
+        // The ID map is estimated as a node of two pointers' overhead per entry plus its buckets
+        std::size_t graphBytes = heapBytes(graph->ids) + heapBytes(graph->offsets) + heapBytes(graph->neighbors) +
+                                 graph->nodes.bucket_count() * sizeof(void*);
+        for (const auto& [id, node] : graph->nodes) {
+            graphBytes += 2 * heapBytes(id) + sizeof(std::pair<const AffiliationID, std::uint32_t>) + 2 * sizeof(void*);
+        }
+        usage.push_back({"connection graph", graphBytes, false});
+    }
+    return usage;
+}
+
+std::size_t Datastructures::node_arena_bytes() const
+{
+    return arenaMemory_.bytes();
+}
+
+bool Datastructures::sync_wal()
+{
+    if (wal_ && !wal_->sync()) {
+        walFailed_ = true;
+        return false;
+    }
+    return wal_ != nullptr;
+}
+
+bool Datastructures::take_wal_failure()
+{
+    bool failed = walFailed_;
+    walFailed_ = false;
+    return failed;
+}
+
+void Datastructures::close_wal()
+{
+    // The data now holds the whole log, reopening it replays nothing
+    if (wal_) {
+        if (!wal_->sync()) {
+            walFailed_ = true;
+        }
+        logPosition_ = wal_->position();
+        wal_.reset();
+    }
+}
+
+Datastructures::Slot Datastructures::allocateSlot(PublicationID id)
+{
+    Slot slot;
+    if (!freeSlots_.empty()) {
+        // Reuse a slot left behind by a removed publication
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+        slotPublication_[slot] = id;
+    } else {
+        slot = slotPublication_.size();
+        slotPublication_.push_back(id);
+        slotParent_.push_back(NO_SLOT);
+        slotJump_.push_back(slot);
+        slotDepth_.push_back(0);
+        slotSize_.push_back(1);
+        tokenNext_.insert(tokenNext_.end(), 2, NO_TOKEN);
+        tokenPrev_.insert(tokenPrev_.end(), 2, NO_TOKEN);
+        tokenLabel_.insert(tokenLabel_.end(), 2, 0);
+    }
+
+    linkSlot(slot, NO_SLOT);
+    slotSize_[slot] = 1;
+    if (!bulkLoading_) {
+        citationIndex_.insert({0, id});
+    }
+
+    // A new publication is a root, its tour is appended to the end of the list
+    tokenNext_[2 * slot] = 2 * slot + 1;
+    tokenPrev_[2 * slot + 1] = 2 * slot;
+    insertTokens(2 * slot, 2 * slot + 1, NO_TOKEN);
+    labelTokens(2 * slot, 2 * slot + 1, 2);
+
+    return slot;
+}
+
+void Datastructures::releaseSlot(Slot slot)
+{
+    // By now the slot has no references left, so only its own size leaves the ancestors
+    for (Slot ancestor = slotParent_[slot]; ancestor != NO_SLOT; ancestor = slotParent_[ancestor]) {
+        --slotSize_[ancestor];
+    }
+    unlinkTokens(2 * slot, 2 * slot + 1);
+
+    citationIndex_.erase({slotDepth_[slot], slotPublication_[slot]});
+    slotPublication_[slot] = NO_PUBLICATION;
+    linkSlot(slot, NO_SLOT);
+    freeSlots_.push_back(slot);
+}
+
+void Datastructures::linkSlot(Slot slot, Slot parent)
+{
+    unsigned int oldDepth = slotDepth_[slot];
+    linkJump(slot, parent);
+
+    // Keep the citation order in step with the depth
+    PublicationID id = slotPublication_[slot];
+    if (id != NO_PUBLICATION && oldDepth != slotDepth_[slot]) {
+        citationIndex_.erase({oldDepth, id});
+        citationIndex_.insert({slotDepth_[slot], id});
+    }
+}
+
+void Datastructures::linkJump(Slot slot, Slot parent)
+{
+    slotParent_[slot] = parent;
+
+    if (parent == NO_SLOT) {
+        // Roots jump to themselves
+        slotJump_[slot] = slot;
+        slotDepth_[slot] = 0;
+    } else {
+        // Skew-binary jump pointers: jump twice as far as the parent when its two previous
+        // jumps are of equal length, otherwise jump to the parent. Needs only O(1) work per
+        // new leaf and gives O(log depth) level-ancestor queries.
+        Slot jump = slotJump_[parent];
+        Slot jump2 = slotJump_[jump];
+        slotDepth_[slot] = slotDepth_[parent] + 1;
+        if (slotDepth_[parent] - slotDepth_[jump] == slotDepth_[jump] - slotDepth_[jump2]) {
+            slotJump_[slot] = jump2;
+        } else {
+            slotJump_[slot] = parent;
+        }
+    }
+}
+
+void Datastructures::moveSubtree(Slot slot, Slot parent)
+{
+    unsigned int size = slotSize_[slot];
+    for (Slot ancestor = slotParent_[slot]; ancestor != NO_SLOT; ancestor = slotParent_[ancestor]) {
+        slotSize_[ancestor] -= size;
+    }
+
+    // Cut the tour of the subtree and splice it in as the last reference of the new parent
+    Token first = 2 * slot;
+    Token last = 2 * slot + 1;
+    unlinkTokens(first, last);
+    insertTokens(first, last, parent == NO_SLOT ? NO_TOKEN : 2 * parent + 1);
+    labelTokens(first, last, 2 * size);
+
+    for (Slot ancestor = parent; ancestor != NO_SLOT; ancestor = slotParent_[ancestor]) {
+        slotSize_[ancestor] += size;
+    }
+
+    // Depths and jump pointers are recomputed in tour order, which visits every
+    // parent before its references. A new leaf needs just this first link.
+    linkSlot(slot, parent);
+    for (Token token = tokenNext_[first]; token != last; token = tokenNext_[token]) {
+        if (token % 2 == 0) {
+            linkSlot(token / 2, slotParent_[token / 2]);
+        }
+    }
+}
+
+void Datastructures::unlinkTokens(Token first, Token last)
+{
+    Token before = tokenPrev_[first];
+    Token after = tokenNext_[last];
+
+    (before == NO_TOKEN ? tokenHead_ : tokenNext_[before]) = after;
+    (after == NO_TOKEN ? tokenTail_ : tokenPrev_[after]) = before;
+    tokenPrev_[first] = NO_TOKEN;
+    tokenNext_[last] = NO_TOKEN;
+}
+
+void Datastructures::insertTokens(Token first, Token last, Token before)
+{
+    // NO_TOKEN as the position appends to the end of the list
+    Token prev = (before == NO_TOKEN) ? tokenTail_ : tokenPrev_[before];
+
+    tokenPrev_[first] = prev;
+    tokenNext_[last] = before;
+    (prev == NO_TOKEN ? tokenHead_ : tokenNext_[prev]) = first;
+    (before == NO_TOKEN ? tokenTail_ : tokenPrev_[before]) = last;
+}
+
+void Datastructures::labelTokens(Token first, Token last, std::size_t count)
+{
+    constexpr int LABEL_BITS = 62;
+    constexpr std::uint64_t LABEL_SPACE = std::uint64_t(1) << LABEL_BITS;
+    constexpr std::uint64_t APPEND_GAP = std::uint64_t(1) << 32;
+
+    Token before = tokenPrev_[first];
+    Token after = tokenNext_[last];
+    std::uint64_t low = (before == NO_TOKEN) ? 0 : tokenLabel_[before];
+    std::uint64_t high = (after == NO_TOKEN) ? LABEL_SPACE : tokenLabel_[after];
+
+    // Spread the new labels evenly over the gap, appends leave room for later appends
+    std::uint64_t step = (high - low) / (count + 1);
+    if (after == NO_TOKEN) {
+        step = std::min(step, APPEND_GAP);
+    }
+    if (step > 0) {
+        std::uint64_t label = low;
+        for (Token token = first; token != after; token = tokenNext_[token]) {
+            label += step;
+            tokenLabel_[token] = label;
+        }
+        return;
+    }
+
+    // Out of room: find the smallest aligned window around the gap whose density is
+    // below 1.4^-bits and relabel it evenly. This keeps inserts amortized O(log^2 n).
+    Token left = before;
+    Token right = after;
+    std::size_t total = count;
+    for (int bits = 1; bits <= LABEL_BITS; ++bits) {
+        std::uint64_t window = std::uint64_t(1) << bits;
+        std::uint64_t windowLow = low & ~(window - 1);
+        std::uint64_t windowHigh = windowLow + window;
+
+        while (left != NO_TOKEN && tokenLabel_[left] >= windowLow) {
+            left = tokenPrev_[left];
+            ++total;
+        }
+        while (right != NO_TOKEN && tokenLabel_[right] < windowHigh) {
+            right = tokenNext_[right];
+            ++total;
+        }
+
+        if (total < std::ldexp(1.0, bits) * std::pow(1.4, -bits) || bits == LABEL_BITS) {
+            std::uint64_t windowStep = window / (total + 1);
+            std::uint64_t label = windowLow;
+            Token token = (left == NO_TOKEN) ? tokenHead_ : tokenNext_[left];
+            for ( ; token != right; token = tokenNext_[token]) {
+                label += windowStep;
+                tokenLabel_[token] = label;
+            }
+            return;
+        }
+    }
+}
+
+bool Datastructures::isInSubtree(Slot slot, Slot root) const
+{
+    // Entry and exit labels of the root enclose the labels of everything below it
+    return tokenLabel_[2 * root] <= tokenLabel_[2 * slot] && tokenLabel_[2 * slot] < tokenLabel_[2 * root + 1];
+}
+
+Datastructures::Slot Datastructures::ancestorAtDepth(Slot slot, unsigned int depth) const
+{
+    while (slotDepth_[slot] > depth) {
+        Slot jump = slotJump_[slot];
+        slot = (slotDepth_[jump] >= depth) ? jump : slotParent_[slot];
+    }
+    return slot;
+}
+
+Datastructures::Slot Datastructures::lowestCommonAncestor(Slot a, Slot b) const
+{
+    // Lift the deeper one to the same depth
+    if (slotDepth_[a] > slotDepth_[b]) {
+        a = ancestorAtDepth(a, slotDepth_[b]);
+    } else {
+        b = ancestorAtDepth(b, slotDepth_[a]);
+    }
+
+    // Jump pointers depend only on depth, so both sides always jump to the same level
+    while (a != b) {
+        if (slotParent_[a] == NO_SLOT) {
+            return NO_SLOT; // Different trees
+        }
+        if (slotJump_[a] != slotJump_[b]) {
+            a = slotJump_[a];
+            b = slotJump_[b];
+        } else {
+            a = slotParent_[a];
+            b = slotParent_[b];
+        }
+    }
+    return a;
+}
+
+void Datastructures::buildAffiliationIndices()
+{
+    // Records added before the bulk load are already indexed, so only the new ones are added
+    std::vector<std::pair<std::string, AffiliationID>> names;
+    std::vector<DistanceEntry> distances;
+    names.reserve(bulkAffiliations_.size());
+    distances.reserve(bulkAffiliations_.size());
+    coordIDMap.reserve(coordIDMap.size() + bulkAffiliations_.size());
+
+    for (const Affiliation* affiliation : bulkAffiliations_) {
+        const Coord& xy = affiliation->coord;
+        names.emplace_back(affiliation->name, affiliation->id);
+        coordIDMap[xy] = affiliation->id;
+        distances.push_back({std::sqrt(xy.x * xy.x + xy.y * xy.y), xy.y, affiliation->id});
+    }
+
+    // Sorted first, the new entries mostly go in at the end hint in constant time
+    std::sort(names.begin(), names.end());
+    std::sort(distances.begin(), distances.end(), DistanceOrder());
+    for (auto& name : names) {
+        nameIDPairs.insert(nameIDPairs.end(), std::move(name));
+    }
+    for (auto& entry : distances) {
+        distanceIDMap.insert(distanceIDMap.end(), std::move(entry));
+    }
+}
+
+void Datastructures::buildConnections()
+{
+    // Number every affiliation ID met in the publications, so that each pair of
+    // affiliations sharing a publication packs into one integer. Sorting the pairs
+    // puts equal ones next to each other and the length of a run is the weight.
+    std::unordered_map<std::string_view, std::uint32_t> numbers;
+    std::vector<const AffiliationID*> ids;
+    std::vector<std::uint64_t> pairs;
+    std::vector<std::uint32_t> local;
+
+    for (const auto& entry : publicationsMapContainer_) {
+        local.clear();
+        for (const AffiliationID& affiliationID : entry.second.affiliations_produced) {
+            auto [it, inserted] = numbers.try_emplace(affiliationID, ids.size());
+            if (inserted) {
+                ids.push_back(&affiliationID);
+            }
+            local.push_back(it->second);
+        }
+
+        for (std::size_t i = 0; i < local.size(); ++i) {
+            for (std::size_t j = i + 1; j < local.size(); ++j) {
+                std::uint64_t low = std::min(local[i], local[j]);
+                std::uint64_t high = std::max(local[i], local[j]);
+                pairs.push_back(low << 32 | high);
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    connectionsMap.clear();
+    for (std::size_t i = 0; i < pairs.size(); ) {
+        std::size_t run = i + 1;
+        while (run < pairs.size() && pairs[run] == pairs[i]) {
+            ++run;
+        }
+
+        const AffiliationID& aff1 = *ids[pairs[i] >> 32];
+        const AffiliationID& aff2 = *ids[pairs[i] & 0xffffffff];
+        Connection connection;
+        connection.aff1 = std::min(aff1, aff2);
+        connection.aff2 = std::max(aff1, aff2);
+        connection.weight = run - i;
+
+        connectionsMap[aff1].push_back(connection);
+        connectionsMap[aff2].push_back(connection);
+        i = run;
+    }
+}
+
+void Datastructures::buildReferenceForest()
+{
+    // Apply the collected references in order, a later reference to the same
+    // publication replaces the earlier one just like add_reference does
+    std::vector<std::size_t> referenceOrder(slotPublication_.size(), 0);
+    for (std::size_t i = 0; i < bulkReferences_.size(); ++i) {
+        auto [id, parentid] = bulkReferences_[i];
+        auto childIt = publicationsMapContainer_.find(id);
+        auto parentIt = publicationsMapContainer_.find(parentid);
+        if (id == parentid) {
+            continue; // A publication can't reference itself
+        }
+
+        PublicationID old_parentid = childIt->second.publication_referenced_by;
+        auto oldParentIt = publicationsMapContainer_.find(old_parentid);
+        if (old_parentid != NO_PUBLICATION && oldParentIt != publicationsMapContainer_.end()) {
+            auto& references = oldParentIt->second.publications_reference_to;
+            references.erase(std::remove(references.begin(), references.end(), id), references.end());
+        }
+
+        parentIt->second.publications_reference_to.push_back(id);
+        childIt->second.publication_referenced_by = parentid;
+        referenceOrder[childIt->second.slot] = i + 1;
+    }
+
+    std::size_t slotCount = slotPublication_.size();
+    for (const auto& entry : publicationsMapContainer_) {
+        auto parentIt = publicationsMapContainer_.find(entry.second.publication_referenced_by);
+        slotParent_[entry.second.slot] = (parentIt == publicationsMapContainer_.end()) ? NO_SLOT : parentIt->second.slot;
+    }
+
+    // Every publication has at most one parent, so following parents from each
+    // publication either reaches a root or runs into a cycle. The newest reference
+    // of a cycle is the one add_reference would have refused, so that one is dropped.
+    std::vector<unsigned char> state(slotCount, 0); // 0 = unseen, 1 = on the current walk, 2 = done
+    std::vector<Slot> walk;
+    for (Slot slot = 0; slot < slotCount; ++slot) {
+        if (slotPublication_[slot] == NO_PUBLICATION || state[slot] != 0) {
+            continue;
+        }
+
+        walk.clear();
+        Slot current = slot;
+        while (current != NO_SLOT && state[current] == 0) {
+            state[current] = 1;
+            walk.push_back(current);
+            current = slotParent_[current];
+        }
+
+        if (current != NO_SLOT && state[current] == 1) {
+            Slot newest = current;
+            for (Slot cycle = slotParent_[current]; cycle != current; cycle = slotParent_[cycle]) {
+                if (referenceOrder[cycle] > referenceOrder[newest]) {
+                    newest = cycle;
+                }
+            }
+
+            auto childIt = publicationsMapContainer_.find(slotPublication_[newest]);
+            auto parentIt = publicationsMapContainer_.find(slotPublication_[slotParent_[newest]]);
+            auto& references = parentIt->second.publications_reference_to;
+            references.erase(std::remove(references.begin(), references.end(), childIt->first), references.end());
+            childIt->second.publication_referenced_by = NO_PUBLICATION;
+            slotParent_[newest] = NO_SLOT;
+        }
+
+        for (Slot visited : walk) {
+            state[visited] = 2;
+        }
+    }
+
+    // References of each slot as one flat array, in the order of the reference
+    // lists so that the tour comes out the same as with add_reference
+    std::vector<Slot> childStart(slotCount + 1, 0);
+    for (const auto& entry : publicationsMapContainer_) {
+        childStart[entry.second.slot + 1] = entry.second.publications_reference_to.size();
+    }
+    for (std::size_t i = 0; i < slotCount; ++i) {
+        childStart[i + 1] += childStart[i];
+    }
+    std::vector<Slot> children(childStart[slotCount]);
+    for (const auto& entry : publicationsMapContainer_) {
+        Slot next = childStart[entry.second.slot];
+        for (PublicationID childid : entry.second.publications_reference_to) {
+            children[next++] = publicationsMapContainer_.find(childid)->second.slot;
+        }
+    }
+
+    // One depth-first pass writes the Euler tour, depths, jump pointers and sizes.
+    // Parents are always linked before their references, as linkJump needs.
+    Token previous = NO_TOKEN;
+    auto append = [&](Token token) {
+        tokenPrev_[token] = previous;
+        (previous == NO_TOKEN ? tokenHead_ : tokenNext_[previous]) = token;
+        previous = token;
+    };
+
+    tokenHead_ = NO_TOKEN;
+    std::size_t tokenCount = 0;
+    std::vector<std::pair<Slot, Slot>> dfs; // slot and the position of its next reference
+    for (Slot root = 0; root < slotCount; ++root) {
+        if (slotPublication_[root] == NO_PUBLICATION || slotParent_[root] != NO_SLOT) {
+            continue;
+        }
+
+        linkJump(root, NO_SLOT);
+        slotSize_[root] = 1;
+        append(2 * root);
+        dfs.emplace_back(root, childStart[root]);
+        while (!dfs.empty()) {
+            auto& [slot, next] = dfs.back();
+            if (next < childStart[slot + 1]) {
+                Slot child = children[next++];
+                linkJump(child, slot);
+                slotSize_[child] = 1;
+                append(2 * child);
+                dfs.emplace_back(child, childStart[child]);
+            } else {
+                Slot done = slot;
+                append(2 * done + 1);
+                dfs.pop_back();
+                if (!dfs.empty()) {
+                    slotSize_[dfs.back().first] += slotSize_[done];
+                }
+            }
+        }
+        tokenCount += 2 * slotSize_[root];
+    }
+
+    if (previous != NO_TOKEN) {
+        tokenNext_[previous] = NO_TOKEN;
+    }
+    tokenTail_ = previous;
+    if (tokenHead_ != NO_TOKEN) {
+        labelTokens(tokenHead_, tokenTail_, tokenCount);
+    }
+
+    // The citation order is sorted in one go, the set takes sorted input in linear time
+    std::vector<std::pair<unsigned int, PublicationID>> citations;
+    citations.reserve(publicationsMapContainer_.size());
+    for (Slot slot = 0; slot < slotCount; ++slot) {
+        if (slotPublication_[slot] != NO_PUBLICATION) {
+            citations.emplace_back(slotDepth_[slot], slotPublication_[slot]);
+        }
+    }
+    std::sort(citations.begin(), citations.end(), CitationOrder());
+    citationIndex_ = decltype(citationIndex_)(citations.begin(), citations.end(), &citationMemory_);
+}
+
+Weight Datastructures::calculateWeight(AffiliationID id1, AffiliationID id2) const {
     // Retrieve publications for both affiliations
     std::vector<PublicationID> publications1 = get_publications(id1);
     std::vector<PublicationID> publications2 = get_publications(id2);
@@ -792,7 +2447,11 @@ Weight Datastructures::calculateWeight(AffiliationID id1, AffiliationID id2) {
     return shared.size();
 }
 
-std::vector<Connection> Datastructures::get_connected_affiliations(AffiliationID id) {
+std::vector<Connection> Datastructures::get_connected_affiliations(AffiliationID id) const {
+    if (image_) {
+        return image_->get_connected_affiliations(id);
+    }
+
     std::vector<Connection> connectedAffiliations;
 
     // Check if the given affiliation ID exists in affiliationsMapContainer_
@@ -833,7 +2492,11 @@ struct ConnectionComparator {
     }
 };
 
-std::vector<Connection> Datastructures::get_all_connections() {
+std::vector<Connection> Datastructures::get_all_connections() const {
+    if (image_) {
+        return image_->get_all_connections();
+    }
+
     std::vector<Connection> allConnections;
     std::set<Connection, ConnectionComparator> uniqueConnections;
 
@@ -852,7 +2515,14 @@ std::vector<Connection> Datastructures::get_all_connections() {
     return allConnections;
 }
 
-std::vector<Connection> Datastructures::getModifiedPath(const std::vector<Connection>& path, AffiliationID source) {
+const Path& Datastructures::connectionsOf(const AffiliationID& id) const
+{
+    static const Path noConnections;
+    auto it = connectionsMap.find(id);
+    return it != connectionsMap.end() ? it->second : noConnections;
+}
+
+std::vector<Connection> Datastructures::getModifiedPath(const std::vector<Connection>& path, AffiliationID source) const {
     std::vector<Connection> modifiedPath = path;
 
     // Modify the first connection if aff1 doesn't match the source affiliation
@@ -870,24 +2540,29 @@ std::vector<Connection> Datastructures::getModifiedPath(const std::vector<Connec
     return modifiedPath;
 }
 
-Path Datastructures::get_any_path(AffiliationID source, AffiliationID target) {
-        // Initialize visited map
-        for (const auto& pair : connectionsMap) {
-            visited[pair.first] = false;
-        }
+Path Datastructures::get_any_path(AffiliationID source, AffiliationID target) const {
+    if (image_) {
+        return image_->get_any_path(source, target);
+    }
+
+        // Search state is per thread, so that concurrent queries don't share it
+        PathScratch& scratch = pathScratch();
+        auto& visited = scratch.visited;
+        auto& parent = scratch.parent;
+        auto& stack = scratch.frontier;
 
-        stack.push(source);
+        stack.push_back(source);
         visited[source] = true;
 
         while (!stack.empty()) {
-            AffiliationID current = stack.top();
-            stack.pop();
+            AffiliationID current = std::move(stack.back());
+            stack.pop_back();
 
-            for (const Connection& connection : connectionsMap[current]) {
+            for (const Connection& connection : connectionsOf(current)) {
                 AffiliationID neighbor = (connection.aff1 == current) ? connection.aff2 : connection.aff1;
 
                 if (!visited[neighbor]) {
-                    stack.push(neighbor);
+                    stack.push_back(neighbor);
                     visited[neighbor] = true;
                     parent[neighbor] = current;
                 }
@@ -902,7 +2577,7 @@ Path Datastructures::get_any_path(AffiliationID source, AffiliationID target) {
         while (current != source && visited[current]) {
             AffiliationID prev = parent[current];
             // Find the connection between current and prev
-            for (const Connection& connection : connectionsMap[current]) {
+            for (const Connection& connection : connectionsOf(current)) {
                 if ((connection.aff1 == current && connection.aff2 == prev) ||
                     (connection.aff1 == prev && connection.aff2 == current)) {
                     path.push_back(connection);
@@ -924,48 +2599,86 @@ Path Datastructures::get_any_path(AffiliationID source, AffiliationID target) {
         }
 }
 
-std::vector<Connection> Datastructures::get_path_with_least_affiliations(AffiliationID source, AffiliationID target) {
-    // Check if source or target affiliations do not exist
-    if (affiliationsMapContainer_.find(source) == affiliationsMapContainer_.end() ||
-        affiliationsMapContainer_.find(target) == affiliationsMapContainer_.end()) {
-        return {}; // Return empty vector if source or target does not exist
+std::vector<Connection> Datastructures::get_path_with_least_affiliations(AffiliationID source, AffiliationID target) const {
+    return pathsWithLeastAffiliations(source, {target}).front();
+}
+
+std::vector<Path> Datastructures::get_path_with_least_affiliations_batch(const std::vector<std::pair<AffiliationID, AffiliationID>>& pairs) const
+{
+    // Pairs with the same source share one search, the results go back in the order of the pairs
+    std::unordered_map<AffiliationID, std::size_t> groupOf;
+    std::vector<std::pair<AffiliationID, std::vector<std::size_t>>> groups;
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+        auto [it, added] = groupOf.emplace(pairs[i].first, groups.size());
+        if (added) {
+            groups.emplace_back(pairs[i].first, std::vector<std::size_t>());
+        }
+        groups[it->second].second.push_back(i);
     }
 
-    // Reset visited and parent maps
-    visited.clear();
-    parent.clear();
+    std::vector<Path> paths(pairs.size());
+    auto search = [&](const std::pair<AffiliationID, std::vector<std::size_t>>& group) {
+        std::vector<AffiliationID> targets;
+        targets.reserve(group.second.size());
+        for (std::size_t i : group.second) {
+            targets.push_back(pairs[i].second);
+        }
+        std::vector<Path> found = pathsWithLeastAffiliations(group.first, targets);
+        for (std::size_t k = 0; k < found.size(); ++k) {
+            paths[group.second[k]] = std::move(found[k]);
+        }
+    };
 
-    std::queue<AffiliationID> queue;
-    queue.push(source);
-    visited[source] = true;
+    // The searches only read the data and use the scratch of their own thread, so
+    // the sources are simply spread over the scheduler one at a time
+    Scheduler::instance().parallel_for(groups.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t group = begin; group < end; ++group) {
+            search(groups[group]);
+        }
+    });
 
-    while (!queue.empty()) {
-        AffiliationID current = queue.front();
-        queue.pop();
+    return paths;
+}
 
-        // Check if the target affiliation is reached
-        if (current == target) {
-            std::vector<Connection> path;
-            // Reconstruct the path using the parent map
-            while (current != source) {
-                AffiliationID prev = parent[current];
-                for (const Connection& connection : connectionsMap[prev]) {
-                    if ((connection.aff1 == prev && connection.aff2 == current) ||
-                        (connection.aff1 == current && connection.aff2 == prev)) {
-                        path.push_back(connection);
-                        break;
-                    }
-                }
-                current = prev;
-            }
-            std::reverse(path.begin(), path.end());
-            std::vector<Connection> finalPath = getModifiedPath(path, source);
-            return finalPath; // Return the modified path if a valid path is found
+std::vector<Path> Datastructures::pathsWithLeastAffiliations(const AffiliationID& source, const std::vector<AffiliationID>& targets) const
+{
+    std::vector<Path> paths(targets.size());
+    if (image_) {
+        for (std::size_t i = 0; i < targets.size(); ++i) {
+            paths[i] = image_->get_path_with_least_affiliations(source, targets[i]);
+        }
+        return paths;
+    }
+
+    // Check if source affiliation does not exist, missing targets just get no path
+    if (affiliationsMapContainer_.find(source) == affiliationsMapContainer_.end()) {
+        return paths;
+    }
+    std::unordered_set<AffiliationID> waiting;
+    for (const AffiliationID& target : targets) {
+        if (affiliationsMapContainer_.find(target) != affiliationsMapContainer_.end()) {
+            waiting.insert(target);
         }
+    }
+
+    // Search state is per thread, so that concurrent queries don't share it.
+    // The frontier vector is the queue, its head advancing over the visited part.
+    PathScratch& scratch = pathScratch();
+    auto& visited = scratch.visited;
+    auto& parent = scratch.parent;
+    auto& queue = scratch.frontier;
+
+    queue.push_back(source);
+    visited[source] = true;
+
+    // The search goes on until every target is reached. A parent is set only when
+    // an affiliation is first met, so going further doesn't change the earlier paths.
+    for (std::size_t head = 0; head < queue.size() && !waiting.empty(); ++head) {
+        AffiliationID current = queue[head];
+        waiting.erase(current);
 
-        //this one is for after not find path
         // Explore connections of the current affiliation
-        for (const Connection& connection : connectionsMap[current]) {
+        for (const Connection& connection : connectionsOf(current)) {
             AffiliationID next;
             if (connection.aff1 == current) {
                 next = connection.aff2;
@@ -976,36 +2689,66 @@ std::vector<Connection> Datastructures::get_path_with_least_affiliations(Affilia
             if (!visited[next]) {
                 visited[next] = true;
                 parent[next] = current;
-                queue.push(next);
+                queue.push_back(next);
             }
         }
     }
 
-    return {}; // Return empty vector if no path is found
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        AffiliationID current = targets[i];
+        if (affiliationsMapContainer_.find(current) == affiliationsMapContainer_.end() || visited.count(current) == 0) {
+            continue; // Empty path if the target is missing or not reached
+        }
+
+        std::vector<Connection> path;
+        // Reconstruct the path using the parent map
+        while (current != source) {
+            AffiliationID prev = parent[current];
+            for (const Connection& connection : connectionsOf(prev)) {
+                if ((connection.aff1 == prev && connection.aff2 == current) ||
+                    (connection.aff1 == current && connection.aff2 == prev)) {
+                    path.push_back(connection);
+                    break;
+                }
+            }
+            current = prev;
+        }
+        std::reverse(path.begin(), path.end());
+        paths[i] = getModifiedPath(path, source);
+    }
+
+    return paths;
 }
 
-Path Datastructures::get_path_of_least_friction(AffiliationID source, AffiliationID target)
+Path Datastructures::get_path_of_least_friction(AffiliationID source, AffiliationID target) const
 {
+    if (image_) {
+        return image_->get_path_of_least_friction(source, target);
+    }
+
     // Check if source or target affiliations do not exist
     if (affiliationsMapContainer_.find(source) == affiliationsMapContainer_.end() ||
         affiliationsMapContainer_.find(target) == affiliationsMapContainer_.end()) {
         return {}; // Return empty vector if source or target does not exist
     }
 
-    // Reset visited and parent maps
-    visited.clear();
-    parent.clear();
+    // Search state is per thread, so that concurrent queries don't share it
+    PathScratch& scratch = pathScratch();
+    auto& visited = scratch.visited;
+    auto& parent = scratch.parent;
 
-    std::priority_queue<std::pair<Weight, AffiliationID>> queue; // Use priority queue based on weight
-    queue.push({0.0, source}); // Start with source and weight 0
+    // Priority queue based on weight, kept as a heap in the scratch vector
+    auto& queue = scratch.weightHeap;
+    queue.push_back({0.0, source}); // Start with source and weight 0
     visited[source] = true;
 
     std::vector<Connection> maxPath;
     Weight maxWeight = 0.0;
 
     while (!queue.empty()) {
-        auto currentPair = queue.top();
-        queue.pop();
+        std::pop_heap(queue.begin(), queue.end());
+        auto currentPair = std::move(queue.back());
+        queue.pop_back();
         Weight currentWeight = currentPair.first;
         AffiliationID current = currentPair.second;
 
@@ -1016,7 +2759,7 @@ Path Datastructures::get_path_of_least_friction(AffiliationID source, Affiliatio
             // Reconstruct the path using the parent map
             while (current != source) {
                 AffiliationID prev = parent[current];
-                for (const Connection& connection : connectionsMap[prev]) {
+                for (const Connection& connection : connectionsOf(prev)) {
                     if ((connection.aff1 == prev && connection.aff2 == current) ||
                         (connection.aff1 == current && connection.aff2 == prev)) {
                         maxPath.push_back(connection);
@@ -1029,7 +2772,7 @@ Path Datastructures::get_path_of_least_friction(AffiliationID source, Affiliatio
         }
 
         // Explore connections of the current affiliation
-        for (const Connection& connection : connectionsMap[current]) {
+        for (const Connection& connection : connectionsOf(current)) {
             AffiliationID next;
             if (connection.aff1 == current) {
                 next = connection.aff2;
@@ -1040,7 +2783,8 @@ Path Datastructures::get_path_of_least_friction(AffiliationID source, Affiliatio
             if (!visited[next]) {
                 visited[next] = true;
                 parent[next] = current;
-                queue.push({currentWeight + connection.weight, next});
+                queue.push_back({currentWeight + connection.weight, next});
+                std::push_heap(queue.begin(), queue.end());
             }
         }
     }
@@ -1048,68 +2792,74 @@ Path Datastructures::get_path_of_least_friction(AffiliationID source, Affiliatio
     return maxPath; // Return the path with the highest weight
 }
 
-PathWithDist Datastructures::get_shortest_path(AffiliationID source, AffiliationID target) {
-    // Check if the source and target IDs exist in the affiliations_ map
-    if (affiliationsMapContainer_.count(source) == 0 || affiliationsMapContainer_.count(target) == 0) {
-        return PathWithDist(); // Return an empty vector if source or target not found
-    }
+PathWithDist Datastructures::get_shortest_path(AffiliationID source, AffiliationID target) const {
+    return get_shortest_paths_from(source, {target}).front();
+}
 
-    // Create a set to store the visited affiliations
-    std::set<AffiliationID> visited;
+std::vector<PathWithDist> Datastructures::get_shortest_paths_from(AffiliationID source, const std::vector<AffiliationID>& targets) const
+{
+    std::vector<PathWithDist> paths(targets.size());
+    if (image_) {
+        for (std::size_t i = 0; i < targets.size(); ++i) {
+            paths[i] = image_->get_shortest_path(source, targets[i]);
+        }
+        return paths;
+    }
 
-    // Create a priority queue to store the next nodes to explore based on distance
-    std::priority_queue<std::pair<Distance, AffiliationID>> pq;
+    // Check if the source ID exists in the affiliations_ map, missing targets just get no path
+    if (affiliationsMapContainer_.count(source) == 0) {
+        return paths;
+    }
+    std::unordered_set<AffiliationID> waiting;
+    for (const AffiliationID& target : targets) {
+        if (affiliationsMapContainer_.count(target) != 0) {
+            waiting.insert(target);
+        }
+    }
 
-    // Map to store the distance from source to each node
-    std::unordered_map<AffiliationID, Distance> distance;
+    // The search state comes from the per thread scratch: the visited affiliations,
+    // the distance from source to each node and the previous node in the shortest path
+    PathScratch& scratch = pathScratch();
+    auto& visited = scratch.visited;
+    auto& distance = scratch.distance;
+    auto& previous = scratch.previous;
 
-    // Map to store the previous node in the shortest path
-    std::unordered_map<AffiliationID, Connection> previous;
+    // Priority queue of the next nodes to explore based on distance, kept as a heap
+    auto& pq = scratch.distanceHeap;
 
     // Initialize distances
     distance[source] = 0;
 
     // Enqueue the source node with distance 0
-    pq.push({0, source});
-
-    while (!pq.empty()) {
-        AffiliationID current = pq.top().second;
-        pq.pop();
-
-        // Check if the current node is the target
-        if (current == target) {
-            // Reconstruct the path
-            PathWithDist result;
-            AffiliationID current_node = target;
-
-            while (previous.find(current_node) != previous.end()) {
-                Connection connection = previous[current_node];
-                // Calculate the distance of the edge by subtracting the distance of the previous node
-                Distance edge_distance = distance[current_node] - distance[connection.aff1 == current_node ? connection.aff2 : connection.aff1];
-                result.push_back({connection, edge_distance});
-                current_node = connection.aff1 == current_node ? connection.aff2 : connection.aff1;
-            }
+    pq.push_back({0, source});
 
-            std::reverse(result.begin(), result.end());
-            return result;
-        }
+    // One search serves all the targets: it goes on until each of them has been
+    // taken from the queue, after which its distance and previous node are final
+    while (!pq.empty() && !waiting.empty()) {
+        std::pop_heap(pq.begin(), pq.end());
+        AffiliationID current = std::move(pq.back().second);
+        pq.pop_back();
 
         // Mark the current node as visited
-        visited.insert(current);
+        visited[current] = true;
+        if (waiting.erase(current) != 0 && waiting.empty()) {
+            break;
+        }
 
-        // Get the connections of the current affiliation
-        std::vector<Connection> connections = get_connected_affiliations(current);
+        // Only known affiliations are queued, so current is always found
+        Coord coord1 = affiliationsMapContainer_.find(current)->second.coord;
 
-        // Loop through the connections
-        for (const Connection &connection : connections) {
+        // Loop through the connections of the current affiliation
+        for (const Connection& connection : connectionsOf(current)) {
             // Get the other affiliation ID
             AffiliationID other = (connection.aff1 == current) ? connection.aff2 : connection.aff1;
 
-            // Check if the other ID is not visited
-            if (visited.count(other) == 0) {
+            // Check if the other ID is not visited. A publication may name affiliations
+            // that were never added, the path can't go through them.
+            auto otherIt = affiliationsMapContainer_.find(other);
+            if (otherIt != affiliationsMapContainer_.end() && visited.count(other) == 0) {
                 // Calculate Euclidean distance inline
-                Coord coord1 = affiliationsMapContainer_[current].coord;
-                Coord coord2 = affiliationsMapContainer_[other].coord;
+                Coord coord2 = otherIt->second.coord;
                 Distance tentative_distance = static_cast<Distance>(
                     std::sqrt(std::pow(coord1.x - coord2.x, 2) + std::pow(coord1.y - coord2.y, 2))
                 );
@@ -1120,15 +2870,98 @@ PathWithDist Datastructures::get_shortest_path(AffiliationID source, Affiliation
                 // If the tentative total distance is smaller, update the distance and enqueue the neighbor
                 if (distance.find(other) == distance.end() || total_distance < distance[other]) {
                     distance[other] = total_distance;
-                    previous[other] = connection;
-                    pq.push({-total_distance, other});
+                    // Stored the way round it is followed, from current to other
+                    previous[other] = {current, other, connection.weight};
+                    pq.push_back({-total_distance, other});
+                    std::push_heap(pq.begin(), pq.end());
                 }
             }
         }
     }
 
-    // If the loop completes, there is no path from source to target
-    return PathWithDist();
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        if (affiliationsMapContainer_.count(targets[i]) == 0 || visited.count(targets[i]) == 0) {
+            continue; // Empty path if the target is missing or not reached
+        }
+
+        // Reconstruct the path
+        PathWithDist& result = paths[i];
+        AffiliationID current_node = targets[i];
+
+        while (previous.find(current_node) != previous.end()) {
+            const Connection& connection = previous[current_node];
+            // Calculate the distance of the edge by subtracting the distance of the previous node
+            Distance edge_distance = distance[current_node] - distance[connection.aff1 == current_node ? connection.aff2 : connection.aff1];
+            result.push_back({connection, edge_distance});
+            current_node = connection.aff1 == current_node ? connection.aff2 : connection.aff1;
+        }
+
+        std::reverse(result.begin(), result.end());
+    }
+
+    return paths;
+}
+
+std::vector<std::pair<AffiliationID, unsigned int>> Datastructures::get_hop_distances(AffiliationID source) const
+{
+    std::shared_ptr<const ConnectionGraph> graph = connectionGraph();
+    auto it = graph->nodes.find(source);
+    if (it == graph->nodes.end()) {
+        return {}; // Source affiliation does not exist
+    }
+
+    std::vector<std::uint32_t> hops = hopDistances(*graph, it->second);
+
+    std::vector<std::pair<AffiliationID, unsigned int>> distances;
+    for (std::size_t node = 0; node < hops.size(); ++node) {
+        if (hops[node] != UNREACHED) {
+            distances.emplace_back(graph->ids[node], hops[node]);
+        }
+    }
+    std::sort(distances.begin(), distances.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second < b.second : a.first < b.first;
+    });
+    return distances;
 }
 
+std::shared_ptr<const ConnectionGraph> Datastructures::connectionGraph() const
+{
+    if (auto graph = std::atomic_load(&connectionGraph_)) {
+        return graph;
+    }
+
+    auto graph = std::make_shared<ConnectionGraph>();
+    graph->ids = get_all_affiliations();
+    graph->nodes.reserve(graph->ids.size());
+    for (std::uint32_t node = 0; node < graph->ids.size(); ++node) {
+        graph->nodes.emplace(graph->ids[node], node);
+    }
+
+    // Connections to affiliations that no longer exist are left out
+    graph->offsets.reserve(graph->ids.size() + 1);
+    graph->offsets.push_back(0);
+    for (const AffiliationID& id : graph->ids) {
+        auto addNeighbors = [&](const std::vector<Connection>& connections) {
+            for (const Connection& connection : connections) {
+                auto neighbor = graph->nodes.find(connection.aff1 == id ? connection.aff2 : connection.aff1);
+                if (neighbor != graph->nodes.end()) {
+                    graph->neighbors.push_back(neighbor->second);
+                }
+            }
+        };
+        if (image_) {
+            addNeighbors(image_->get_connected_affiliations(id));
+        } else {
+            addNeighbors(connectionsOf(id));
+        }
+        graph->offsets.push_back(graph->neighbors.size());
+    }
+
+    std::atomic_store(&connectionGraph_, std::shared_ptr<const ConnectionGraph>(graph));
+    return graph;
+}
 
+void Datastructures::invalidateConnectionGraph()
+{
+    std::atomic_store(&connectionGraph_, std::shared_ptr<const ConnectionGraph>());
+}
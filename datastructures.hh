@@ -18,6 +18,14 @@
 #include <stack>
 #include <set>
 #include <queue>
+#include <cstdint>
+#include <unordered_map>
+#include <memory_resource>
+#include <iterator>
+#include <iosfwd>
+#include <memory>
+#include <algorithm>
+#include <cmath>
 
 
 // Types for IDs
@@ -43,6 +51,9 @@ Weight const NO_WEIGHT = -1;
 // Return value for cases where integer values were not found
 int const NO_VALUE = std::numeric_limits<int>::min();
 
+// Return value for counts and depths of publications that were not found
+unsigned int const NO_COUNT = std::numeric_limits<unsigned int>::max();
+
 // Type for a coordinate (x, y)
 struct Coord
 {
@@ -81,41 +92,139 @@ inline bool operator<(Coord c1, Coord c2)
 // Return value for cases where coordinates were not found
 Coord const NO_COORD = {NO_VALUE, NO_VALUE};
 
+// Memory resource that counts the bytes it has handed out and not yet taken
+// back. Placed in front of the resource of a container, it shows how much
+// the container's nodes, buckets and pooled inner vectors take.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : upstream_(upstream) {}
+
+    std::size_t bytes() const { return bytes_; }
+    std::size_t peak_bytes() const { return peakBytes_; }
+    std::size_t blocks() const { return blocks_; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void* block = upstream_->allocate(bytes, alignment);
+        bytes_ += bytes;
+        ++blocks_;
+        peakBytes_ = std::max(peakBytes_, bytes_);
+        return block;
+    }
+
+    void do_deallocate(void* block, std::size_t bytes, std::size_t alignment) override
+    {
+        upstream_->deallocate(block, bytes, alignment);
+        bytes_ -= bytes;
+        --blocks_;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    std::size_t bytes_ = 0;
+    std::size_t peakBytes_ = 0;
+    std::size_t blocks_ = 0;
+};
+
+// Bytes taken by one internal structure, see Datastructures::memory_usage
+struct MemoryUsage
+{
+    std::string structure;
+    std::size_t bytes = 0;
+    bool perPublication = false; // Grows with the publications rather than the affiliations
+};
+
+// The connections as a graph in compressed sparse row form: the affiliations are
+// numbered and the neighbours of node i are neighbors[offsets[i]] .. neighbors[offsets[i + 1] - 1]
+struct ConnectionGraph
+{
+    std::vector<AffiliationID> ids;
+    std::unordered_map<AffiliationID, std::uint32_t> nodes;
+    std::vector<std::size_t> offsets;
+    std::vector<std::uint32_t> neighbors;
+};
+
+// Affiliations and publications live in pooled containers, so both are
+// allocator-aware and place their inner vectors in the same pool
 struct Affiliation {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
     AffiliationID id;
     Name name;
     Coord coord;
-    std::vector<PublicationID> publications_produced;
+    std::pmr::vector<PublicationID> publications_produced;
 
     // Default constructor
-    Affiliation() : id(""), name(""), coord({NO_VALUE, NO_VALUE}) {
-        publications_produced = {}; // Initialize the vector with an empty list
-    }
+    explicit Affiliation(const allocator_type& alloc = {})
+        : id(""), name(""), coord({NO_VALUE, NO_VALUE}), publications_produced(alloc) {}
 
     // Parameterized constructor
-    Affiliation(AffiliationID id, const Name& name, Coord xy)
-        : id(id), name(name), coord(xy), publications_produced({}) {}
+    Affiliation(AffiliationID id, Name name, Coord xy, const allocator_type& alloc = {})
+        : id(std::move(id)), name(std::move(name)), coord(xy), publications_produced(alloc) {}
+
+    // Allocator-extended copy and move
+    Affiliation(const Affiliation& other, const allocator_type& alloc)
+        : id(other.id), name(other.name), coord(other.coord), publications_produced(other.publications_produced, alloc) {}
+    Affiliation(Affiliation&& other, const allocator_type& alloc)
+        : id(std::move(other.id)), name(std::move(other.name)), coord(other.coord),
+          publications_produced(std::move(other.publications_produced), alloc) {}
+
+    Affiliation(const Affiliation&) = default;
+    Affiliation(Affiliation&&) = default;
+    Affiliation& operator=(const Affiliation&) = default;
+    Affiliation& operator=(Affiliation&&) = default;
 };
 
 
 struct Publication {
-    Publication() : id(0), title(""), publicationYear(0), publication_referenced_by(0) {
-        // Initialize with default values
-        affiliations_produced = {}; // Initialize the vector with an empty list
-        publications_reference_to = {}; // Initialize the vector with an empty list
-    }
-
-    Publication(PublicationID id, Name title, Year year, const std::vector<AffiliationID>& affiliations)
-        : id(id), title(title), publicationYear(year), affiliations_produced(affiliations), publication_referenced_by(0) {
-        publications_reference_to = {}; // Initialize the vector with an empty list
-    }
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    explicit Publication(const allocator_type& alloc = {})
+        : id(0), title(""), publicationYear(0), affiliations_produced(alloc), publications_reference_to(alloc),
+          publication_referenced_by(NO_PUBLICATION), slot(0) {}
+
+    Publication(PublicationID id, Name title, Year year, const std::vector<AffiliationID>& affiliations, const allocator_type& alloc = {})
+        : id(id), title(std::move(title)), publicationYear(year), affiliations_produced(affiliations.begin(), affiliations.end(), alloc),
+          publications_reference_to(alloc), publication_referenced_by(NO_PUBLICATION), slot(0) {}
+
+    // Takes over the affiliation IDs instead of copying them
+    Publication(PublicationID id, Name title, Year year, std::vector<AffiliationID>&& affiliations, const allocator_type& alloc = {})
+        : id(id), title(std::move(title)), publicationYear(year),
+          affiliations_produced(std::make_move_iterator(affiliations.begin()), std::make_move_iterator(affiliations.end()), alloc),
+          publications_reference_to(alloc), publication_referenced_by(NO_PUBLICATION), slot(0) {}
+
+    // Allocator-extended copy and move
+    Publication(const Publication& other, const allocator_type& alloc)
+        : id(other.id), title(other.title), publicationYear(other.publicationYear),
+          affiliations_produced(other.affiliations_produced, alloc), publications_reference_to(other.publications_reference_to, alloc),
+          publication_referenced_by(other.publication_referenced_by), slot(other.slot) {}
+    Publication(Publication&& other, const allocator_type& alloc)
+        : id(other.id), title(std::move(other.title)), publicationYear(other.publicationYear),
+          affiliations_produced(std::move(other.affiliations_produced), alloc),
+          publications_reference_to(std::move(other.publications_reference_to), alloc),
+          publication_referenced_by(other.publication_referenced_by), slot(other.slot) {}
+
+    Publication(const Publication&) = default;
+    Publication(Publication&&) = default;
+    Publication& operator=(const Publication&) = default;
+    Publication& operator=(Publication&&) = default;
 
     PublicationID id;
     Name title;
     Year publicationYear;
-    std::vector<AffiliationID> affiliations_produced;
-    std::vector<PublicationID> publications_reference_to;
+    std::pmr::vector<AffiliationID> affiliations_produced;
+    std::pmr::vector<PublicationID> publications_reference_to;
     PublicationID publication_referenced_by;
+
+    // Position of this publication in the reference forest index
+    unsigned int slot;
 };
 
 
@@ -150,6 +259,9 @@ private:
     std::string msg_;
 };
 
+class MappedImage;
+class WriteAheadLog;
+
 // This is the class you are supposed to implement
 
 class Datastructures
@@ -160,42 +272,116 @@ public:
 
     // Estimate of performance:
     // Short rationale for estimate:
-    unsigned int get_affiliation_count();
+    unsigned int get_affiliation_count() const;
 
     // Estimate of performance:
     // Short rationale for estimate:
     void clear_all();
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<AffiliationID> get_all_affiliations();
-
-    // Estimate of performance:
-    // Short rationale for estimate:
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: only switches the add operations to storing plain records
+    // Until end_bulk_load, queries see the records but not the indices built from them: the name and
+    // distance orders, find_affiliation_with_coord, the connection and path queries and everything
+    // about references (get_parent, chains, depths, subtree sizes) return results without the
+    // records added since begin_bulk_load. The queries are const and may run concurrently, so they do
+    // not finish the load themselves; removals, coordinate changes, snapshots and images do, and callers needing current
+    // answers call end_bulk_load first.
+    void begin_bulk_load();
+
+    // Estimate of performance: O(n log n + p log p), n = affiliations, p = affiliation pairs over all publications
+    // Short rationale for estimate: every index is built once by sorting instead of paying the incremental cost per add
+    void end_bulk_load();
+
+    // Estimate of performance: O(n + p + c), the sizes of the affiliations, publications and connections
+    // Short rationale for estimate: every record is written once into a buffer, which is checksummed and written in one go
+    // With a log open, the log is synced first and saving fails if that fails
+    bool save_snapshot(std::ostream& output);
+
+    // Estimate of performance: O(n log n + p + c)
+    // Short rationale for estimate: records are read back as in a bulk load, only the affiliation orders need sorting
+    // A file that is damaged or whose references don't add up is rejected, leaving the data empty
+    bool load_snapshot(std::istream& input);
+
+    // Estimate of performance: O(n log n + p + c)
+    // Short rationale for estimate: the flat layout is filled in one pass, node and publication tables are sorted by ID
+    bool save_image(std::ostream& output);
+
+    // Estimate of performance: O(n + p + c), the records in the image
+    // Short rationale for estimate: the file is mapped, not deserialized, but every record is checked once so
+    // that a damaged image is rejected. While an image is open the data is read-only and every query is answered from the image.
+    bool open_image(const std::string& filename);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: only unmaps the file, the data set is empty afterwards
+    void close_image();
+
+    // Estimate of performance: O(r), r = records in the log
+    // Short rationale for estimate: every record is replayed through the operation that logged it,
+    // bulk loads included, after which every successful mutation appends one record.
+    // Snapshot loads are not logged, so a log continuing a snapshot is opened after the
+    // snapshot has been loaded (loading one closes the open log). A snapshot saved while a
+    // log is open stores the log's length and replay skips the records before it; a log
+    // shorter than that is rejected.
+    bool open_wal(const std::string& filename, unsigned int syncEvery);
+
+    // Estimate of performance: O(b), b = bytes buffered since the last sync
+    // Short rationale for estimate: one write and one fsync for the whole batch
+    bool sync_wal();
+
+    // Estimate of performance: O(b)
+    // Short rationale for estimate: syncs the pending records and closes the file
+    void close_wal();
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: reads and clears a flag.
+    // True if writing to the log failed since the last call. The changes are made in memory
+    // and their records stay buffered; later writes and sync_wal retry them.
+    bool take_wal_failure();
+
+    // Estimate of performance: O(n + p + c)
+    // Short rationale for estimate: node and bucket memory is read off counting resources,
+    // but the strings and vectors held by the entries are added up one by one
+    std::vector<MemoryUsage> memory_usage() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: the pools' chunks and large blocks come from a counting resource. This is what
+    // the affiliation and publication pools hold, including their free lists, so it overlaps memory_usage.
+    std::size_t node_arena_bytes() const;
+
+    // Estimate of performance:
+    // Short rationale for estimate:
+    std::vector<AffiliationID> get_all_affiliations() const;
+
+    // Estimate of performance: O(log n)
+    // Short rationale for estimate: the name and distance orders take one ordered insert each, the maps constant time
     bool add_affiliation(AffiliationID id, Name const& name, Coord xy);
 
+    // Estimate of performance: as above
+    // Short rationale for estimate: same operation, the ID and name are moved into place instead of copied
+    bool add_affiliation(AffiliationID id, Name&& name, Coord xy);
+
     // Estimate of performance:
     // Short rationale for estimate:
-    Name get_affiliation_name(AffiliationID id);
+    Name get_affiliation_name(AffiliationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Coord get_affiliation_coord(AffiliationID id);
+    Coord get_affiliation_coord(AffiliationID id) const;
 
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<AffiliationID> get_affiliations_alphabetically();
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: the name order is kept sorted on every change, the query only copies the IDs out
+    std::vector<AffiliationID> get_affiliations_alphabetically() const;
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<AffiliationID> get_affiliations_distance_increasing();
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: the distance order is kept sorted on every change, the query only copies the IDs out
+    std::vector<AffiliationID> get_affiliations_distance_increasing() const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    AffiliationID find_affiliation_with_coord(Coord xy);
+    AffiliationID find_affiliation_with_coord(Coord xy) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
@@ -208,29 +394,35 @@ public:
     // Short rationale for estimate:
     bool add_publication(PublicationID id, Name const& name, Year year, const std::vector<AffiliationID> & affiliations);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<PublicationID> all_publications();
+    // Estimate of performance: as above
+    // Short rationale for estimate: same operation, the name and affiliation IDs are moved into place instead of copied
+    bool add_publication(PublicationID id, Name&& name, Year year, std::vector<AffiliationID>&& affiliations);
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Name get_publication_name(PublicationID id);
+    std::vector<PublicationID> all_publications() const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Year get_publication_year(PublicationID id);
+    Name get_publication_name(PublicationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<AffiliationID> get_affiliations(PublicationID id);
+    Year get_publication_year(PublicationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
+    std::vector<AffiliationID> get_affiliations(PublicationID id) const;
+
+    // Estimate of performance: O(d + log n) for a new leaf at depth d, O(k + d) when moving a subtree of
+    // k publications, plus amortized O(log^2 n) for relabeling the Euler tour
+    // Short rationale for estimate: a leaf needs one jump pointer, a moved subtree is relinked top-down,
+    // and the subtree sizes of all d ancestors are updated so that the size queries stay O(1)
     bool add_reference(PublicationID id, PublicationID parentid);
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<PublicationID> get_direct_references(PublicationID id);
+    std::vector<PublicationID> get_direct_references(PublicationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
@@ -238,38 +430,62 @@ public:
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<PublicationID> get_publications(AffiliationID id);
+    std::vector<PublicationID> get_publications(AffiliationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    PublicationID get_parent(PublicationID id);
+    PublicationID get_parent(PublicationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year);
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(AffiliationID affiliationid, Year year) const;
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<PublicationID> get_referenced_by_chain(PublicationID id);
+    // Estimate of performance: O(d), d = length of the chain
+    // Short rationale for estimate: parent slots are followed iteratively into a vector reserved from the stored depth
+    std::vector<PublicationID> get_referenced_by_chain(PublicationID id) const;
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: jump pointers skip over exponentially growing parts of the chain
+    PublicationID get_ancestor_at_depth(PublicationID id, unsigned int depth) const;
 
 
     // Non-compulsory operations
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<PublicationID> get_all_references(PublicationID id);
+    // Estimate of performance: O(k), k = number of references returned
+    // Short rationale for estimate: the references form one contiguous range of the Euler tour list
+    std::vector<PublicationID> get_all_references(PublicationID id) const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: subtree sizes are maintained by add_reference and remove_publication
+    unsigned int count_all_references(PublicationID id) const;
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: plain depth-first search, kept for comparison with get_all_references
+    std::vector<PublicationID> get_all_references_dfs(PublicationID id) const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: depth is stored in the reference forest index
+    unsigned int get_citation_depth(PublicationID id) const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: subtree sizes are maintained by add_reference and remove_publication
+    unsigned int get_subtree_size(PublicationID id) const;
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: publications are kept ordered by citation depth, the first k are read off
+    std::vector<PublicationID> get_most_cited(unsigned int k) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy);
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
     bool remove_affiliation(AffiliationID id);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2);
+    // Estimate of performance: O(log d), d = depth of the reference tree
+    // Short rationale for estimate: skew-binary jump pointers lift both publications in logarithmic steps
+    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
@@ -279,52 +495,181 @@ public:
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<Connection> get_connected_affiliations(AffiliationID id);
+    std::vector<Connection> get_connected_affiliations(AffiliationID id) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    std::vector<Connection> get_all_connections();
+    std::vector<Connection> get_all_connections() const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Path get_any_path(AffiliationID source, AffiliationID target);
+    Path get_any_path(AffiliationID source, AffiliationID target) const;
 
     // PRG2 optional functions
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Path get_path_with_least_affiliations(AffiliationID source, AffiliationID target);
+    Path get_path_with_least_affiliations(AffiliationID source, AffiliationID target) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    Path get_path_of_least_friction(AffiliationID source, AffiliationID target);
+    Path get_path_of_least_friction(AffiliationID source, AffiliationID target) const;
 
     // Estimate of performance:
     // Short rationale for estimate:
-    PathWithDist get_shortest_path(AffiliationID source, AffiliationID target);
+    PathWithDist get_shortest_path(AffiliationID source, AffiliationID target) const;
 
+    // Estimate of performance: O((N + C) log C), N affiliations and C connections
+    // Short rationale for estimate: one Dijkstra search serves all the targets, it stops once the last one is settled
+    std::vector<PathWithDist> get_shortest_paths_from(AffiliationID source, const std::vector<AffiliationID>& targets) const;
 
-private:
-    // Define a flag to check if the data has been sorted
-    bool affiliationsSortedFlag = false;
-    bool distancesSortedFlag = false;
+    // Estimate of performance: O(S (N + C) / T) for S distinct sources on T threads
+    // Short rationale for estimate: one breadth-first search per distinct source, the sources are spread over the threads
+    std::vector<Path> get_path_with_least_affiliations_batch(const std::vector<std::pair<AffiliationID, AffiliationID>>& pairs) const;
 
-    // Create a vector of pairs to hold affiliation names and IDs
-    std::vector<std::pair<std::string, AffiliationID>> nameIDPairs;
-    std::unordered_map<Coord, AffiliationID, CoordHash> coordIDMap;
-    std::vector<std::pair<double, AffiliationID>> distanceIDMap;
+    // Estimate of performance: O(N + C) work spread over the scheduler's threads, plus O(N + C) to build the graph after a change
+    // Short rationale for estimate: a level-synchronous breadth-first search over the cached ConnectionGraph,
+    // each level either expands the frontier (top-down) or lets the unreached affiliations look for it (bottom-up)
+    // Returns the affiliations reachable from source with their hop counts, nearest first and then by ID
+    std::vector<std::pair<AffiliationID, unsigned int>> get_hop_distances(AffiliationID source) const;
 
-    std::unordered_map<AffiliationID, Affiliation> affiliationsMapContainer_;
-    std::unordered_map<PublicationID, Publication> publicationsMapContainer_;
 
-    std::unordered_map<AffiliationID, Path> connectionsMap;
-    Weight calculateWeight(AffiliationID id1, AffiliationID id2);
+private:
+    // The node based containers allocate through counting resources for memory_usage
+    CountingResource coordMemory_;
+    CountingResource connectionsMemory_;
+    CountingResource citationMemory_;
+    CountingResource nameMemory_;
+    CountingResource distanceMemory_;
+
+    // Affiliations in distance order: distance from the origin, then smaller y first
+    struct DistanceEntry
+    {
+        double distance;
+        int y;
+        AffiliationID id;
+    };
+    struct DistanceOrder
+    {
+        bool operator()(const DistanceEntry& a, const DistanceEntry& b) const
+        {
+            if (std::abs(a.distance - b.distance) >= 1e-9) {
+                return a.distance < b.distance;
+            }
+            return a.y != b.y ? a.y < b.y : a.id < b.id;
+        }
+    };
+
+    // The name and distance orders are kept sorted as affiliations change, so the
+    // queries only read them and concurrent readers need no locking
+    std::pmr::set<std::pair<std::string, AffiliationID>> nameIDPairs{&nameMemory_};
+    std::pmr::unordered_map<Coord, AffiliationID, CoordHash> coordIDMap{&coordMemory_};
+    std::pmr::set<DistanceEntry, DistanceOrder> distanceIDMap{&distanceMemory_};
+
+    // Affiliations and publications are allocated from per-type pools, whose free
+    // lists recycle the nodes of removed entries. Blocks too large for the pools,
+    // such as bucket arrays and long publication lists, go straight to the heap
+    // and back when freed, so under churn the pools hold at most the peak number
+    // of live nodes. clear_all hands the memory back with a few releases instead
+    // of node by node.
+    CountingResource arenaMemory_;
+    std::pmr::unsynchronized_pool_resource affiliationPool_{&arenaMemory_};
+    std::pmr::unsynchronized_pool_resource publicationPool_{&arenaMemory_};
+    CountingResource affiliationMemory_{&affiliationPool_};
+    CountingResource publicationMemory_{&publicationPool_};
+
+    std::pmr::unordered_map<AffiliationID, Affiliation> affiliationsMapContainer_{&affiliationMemory_};
+    std::pmr::unordered_map<PublicationID, Publication> publicationsMapContainer_{&publicationMemory_};
+
+    // Read-only image replacing the containers above while it is open
+    std::unique_ptr<MappedImage> image_;
+
+    // Log of the successful mutations while one is open, see open_wal
+    std::unique_ptr<WriteAheadLog> wal_;
+    // Bytes of the log whose records the data already holds, kept in snapshots.
+    // Only meaningful while no log is open; an open log is always replayed to its end.
+    std::uint64_t logPosition_ = 0;
+    bool walFailed_ = false;
+    bool replayLog(const std::string& data, std::uint64_t& validSize);
+
+    // clear_all without the log record, used when the data is replaced wholesale
+    void clearData();
+
+    std::pmr::unordered_map<AffiliationID, Path> connectionsMap{&connectionsMemory_};
+    Weight calculateWeight(AffiliationID id1, AffiliationID id2) const;
+
+    // Shared by the copying and moving overloads, constructs each record in place exactly once
+    template <typename NameArg>
+    bool addAffiliation(AffiliationID&& id, NameArg&& name, Coord xy);
+    template <typename NameArg, typename AffiliationsArg>
+    bool addPublication(PublicationID id, NameArg&& name, Year year, AffiliationsArg&& affiliations);
+
+    // Bulk loading. While it is on, the add operations only store the records
+    // and end_bulk_load builds the derived indices from them in a few passes.
+    bool bulkLoading_ = false;
+    std::vector<const Affiliation*> bulkAffiliations_;
+    std::vector<std::pair<PublicationID, PublicationID>> bulkReferences_;
+    void buildAffiliationIndices();
+    void buildConnections();
+    void buildReferenceForest();
 
     //for path
-    std::unordered_map<AffiliationID, bool> visited;
-    std::unordered_map<AffiliationID, AffiliationID> parent;
-    std::stack<AffiliationID> stack;
-    std::vector<Connection> getModifiedPath(const std::vector<Connection>& path, AffiliationID source);
+    const Path& connectionsOf(const AffiliationID& id) const; // Empty for an affiliation without connections
+    std::vector<Connection> getModifiedPath(const std::vector<Connection>& path, AffiliationID source) const;
+    // The connection graph of the whole-graph searches, built on first use after a change.
+    // Accessed only with std::atomic_load and std::atomic_store, so concurrent queries can
+    // share it; two of them racing to build it both build the same graph.
+    mutable std::shared_ptr<const ConnectionGraph> connectionGraph_;
+    std::shared_ptr<const ConnectionGraph> connectionGraph() const;
+    void invalidateConnectionGraph();
+
+    // Breadth-first search from source until every target is reached, one path per target
+    std::vector<Path> pathsWithLeastAffiliations(const AffiliationID& source, const std::vector<AffiliationID>& targets) const;
+
+    // Reference forest index. Every publication owns a dense slot storing its
+    // parent, depth and a skew-binary jump pointer, so ancestor and common
+    // parent queries take O(log depth) steps instead of walking whole chains.
+    using Slot = unsigned int;
+    static constexpr Slot NO_SLOT = std::numeric_limits<Slot>::max();
+    std::vector<PublicationID> slotPublication_;
+    std::vector<Slot> slotParent_;
+    std::vector<Slot> slotJump_;
+    std::vector<unsigned int> slotDepth_;
+    std::vector<Slot> freeSlots_;
+
+    // Euler tour of the reference forest kept as an order-maintenance list:
+    // slot s opens with token 2s and closes with token 2s+1, and all references
+    // of a publication lie between its own two tokens. Labels grow along the
+    // list and are relabeled in sparse enough windows when an insert runs out of room.
+    using Token = unsigned int;
+    static constexpr Token NO_TOKEN = std::numeric_limits<Token>::max();
+    std::vector<Token> tokenNext_;
+    std::vector<Token> tokenPrev_;
+    std::vector<std::uint64_t> tokenLabel_;
+    Token tokenHead_ = NO_TOKEN;
+    Token tokenTail_ = NO_TOKEN;
+    std::vector<unsigned int> slotSize_;
+
+    // Publications ordered by the number of publications citing them directly or
+    // through a chain, i.e. their depth, most cited first and ties by ID
+    struct CitationOrder {
+        bool operator()(const std::pair<unsigned int, PublicationID>& a, const std::pair<unsigned int, PublicationID>& b) const {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+    std::pmr::set<std::pair<unsigned int, PublicationID>, CitationOrder> citationIndex_{&citationMemory_};
+
+    Slot allocateSlot(PublicationID id);
+    void releaseSlot(Slot slot);
+    void linkSlot(Slot slot, Slot parent);
+    void linkJump(Slot slot, Slot parent);
+    void moveSubtree(Slot slot, Slot parent);
+    void unlinkTokens(Token first, Token last);
+    void insertTokens(Token first, Token last, Token before);
+    void labelTokens(Token first, Token last, std::size_t count);
+    bool isInSubtree(Slot slot, Slot root) const;
+    Slot ancestorAtDepth(Slot slot, unsigned int depth) const;
+    Slot lowestCommonAncestor(Slot a, Slot b) const;
    };
 
 
@@ -30,6 +30,8 @@ using std::ostream;
 
 #include <fstream>
 using std::ifstream;
+using std::ofstream;
+using std::ios;
 
 #include <sstream>
 using std::istringstream;
@@ -112,10 +114,24 @@ using std::back_inserter;
 #include <cstddef>
 #include <cassert>
 
+#include <charconv>
+#include <cctype>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <future>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define MAINPROGRAM_RUSAGE
+#endif
 
 #include "mainprogram.hh"
 
 #include "datastructures.hh"
+#include "scheduler.hh"
+#include "versioneddatastructures.hh"
 
 #ifdef GRAPHICAL_GUI
 #include "mainwindow.hh"
@@ -123,6 +139,226 @@ using std::back_inserter;
 
 string const MainProgram::PROMPT = "> ";
 
+thread_local std::minstd_rand* MainProgram::thread_rand_engine_ = nullptr;
+
+namespace
+{
+// [[:space:]] of the parameter regexes
+char const SPACE_CHARS[] = " \t\n\v\f\r";
+
+bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+bool is_id_char(char c) { return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-'; }
+bool is_name_char(char c) { return is_id_char(c) || c == ' '; }
+
+// Consumes the longest run of characters of a class starting at pos
+std::string_view take_while(std::string_view text, std::size_t& pos, bool (*inclass)(char))
+{
+    std::size_t start = pos;
+    while (pos < text.size() && inclass(text[pos])) { ++pos; }
+    return text.substr(start, pos - start);
+}
+
+bool take_char(std::string_view text, std::size_t& pos, char c)
+{
+    if (pos == text.size() || text[pos] != c) { return false; }
+    ++pos;
+    return true;
+}
+
+// Field of a CSV line without surrounding whitespace and quotes
+std::string_view trim_csv_field(std::string_view field)
+{
+    std::size_t first = field.find_first_not_of(SPACE_CHARS);
+    if (first == std::string_view::npos) { return {}; }
+    field = field.substr(first, field.find_last_not_of(SPACE_CHARS) - first + 1);
+    if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+    {
+        field = field.substr(1, field.size() - 2);
+    }
+    return field;
+}
+
+// Imported IDs and names must be ones the command grammar can express (affiliationidx
+// and namex below), otherwise no command could query them afterwards
+bool is_csv_affiliation_id(std::string_view text)
+{
+    return !text.empty() && std::all_of(text.begin(), text.end(), is_id_char);
+}
+
+bool is_csv_name(std::string_view text)
+{
+    return !text.empty() && std::all_of(text.begin(), text.end(), is_name_char);
+}
+
+// Splits a CSV line at the commas outside quotes into fields without surrounding whitespace.
+// A quoted field keeps everything between its quotes, "" standing for one quote. Only the
+// first fields.size() fields are stored, but all are counted. False if a quote is left open
+// or something other than whitespace follows a closing quote.
+template <std::size_t Size>
+bool split_csv_line(std::string_view line, std::array<std::string, Size>& fields, std::size_t& count)
+{
+    count = 0;
+    std::size_t pos = 0;
+    std::string extra;
+    while (true)
+    {
+        // Fields past the stored ones are parsed into a scratch string to find where they end
+        std::string& field = count < fields.size() ? fields[count] : extra;
+        field.clear();
+        pos = std::min(line.find_first_not_of(SPACE_CHARS, pos), line.size());
+        std::size_t next = 0;
+        if (pos < line.size() && line[pos] == '"')
+        {
+            for (++pos; ; pos += 2)
+            {
+                std::size_t quote = line.find('"', pos);
+                if (quote == std::string_view::npos) { return false; }
+                field.append(line.substr(pos, quote - pos));
+                pos = quote;
+                if (pos + 1 == line.size() || line[pos + 1] != '"') { break; }
+                field.push_back('"');
+            }
+            next = std::min(line.find_first_not_of(SPACE_CHARS, pos + 1), line.size());
+            if (next < line.size() && line[next] != ',') { return false; }
+        }
+        else
+        {
+            next = std::min(line.find(',', pos), line.size());
+            std::string_view text = line.substr(pos, next - pos);
+            field.assign(text.substr(0, text.find_last_not_of(SPACE_CHARS) + 1));
+        }
+
+        ++count;
+        if (next == line.size()) { return true; }
+        pos = next + 1;
+    }
+}
+
+// True if the fields are the leading column names of header, ignoring case
+bool is_csv_header(std::string const* fields, std::size_t count, std::string_view header)
+{
+    auto lower = [](char c) { return std::tolower(static_cast<unsigned char>(c)); };
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (pos > header.size()) { return false; }
+        std::size_t next = std::min(header.find(',', pos), header.size());
+        std::string_view column = header.substr(pos, next - pos);
+        if (!std::equal(fields[i].begin(), fields[i].end(), column.begin(), column.end(),
+                        [&lower](char a, char b) { return lower(a) == lower(b); }))
+        {
+            return false;
+        }
+        pos = next + 1;
+    }
+    return true;
+}
+
+// Affiliation IDs of a parameter list the regexes have already validated
+vector<AffiliationID> split_affiliation_list(std::string_view list)
+{
+    vector<AffiliationID> ids;
+    std::size_t pos = 0;
+    while ((pos = list.find_first_not_of(SPACE_CHARS, pos)) != std::string_view::npos)
+    {
+        std::size_t last = list.find_first_of(SPACE_CHARS, pos);
+        ids.emplace_back(list.substr(pos, last - pos));
+        pos = last;
+    }
+    return ids;
+}
+
+template <typename Type>
+bool parse_csv_number(std::string_view text, Type& value)
+{
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() && end == text.data() + text.size();
+}
+
+// Peak resident set size of the process in kilobytes, -1 if not known
+long peak_rss_kb()
+{
+#ifdef MAINPROGRAM_RUSAGE
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) { return -1; }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+// Candidate complexity classes for the times measured in perftest
+struct ComplexityModel
+{
+    char const* name;
+    double(*f)(double n);
+};
+ComplexityModel const COMPLEXITY_MODELS[] = {
+    {"O(1)", [](double) { return 1.0; }},
+    {"O(log N)", [](double n) { return std::log2(n); }},
+    {"O(N)", [](double n) { return n; }},
+    {"O(N log N)", [](double n) { return n * std::log2(n); }},
+    {"O(N^2)", [](double n) { return n * n; }},
+};
+
+struct ComplexityFit
+{
+    std::size_t model = 0; // Index to COMPLEXITY_MODELS
+    double coefficient = 0;
+    double rms = 0; // Root mean square error relative to the mean time
+};
+
+// Least squares fit of time = coefficient * f(N) for each model, the one with the smallest error wins
+ComplexityFit fit_complexity(vector<double> const& ns, vector<double> const& times)
+{
+    double mean = 0;
+    for (double time : times) { mean += time; }
+    mean /= times.size();
+
+    ComplexityFit best;
+    best.rms = std::numeric_limits<double>::infinity();
+    for (std::size_t m = 0; m < std::size(COMPLEXITY_MODELS); ++m)
+    {
+        double sumft = 0;
+        double sumff = 0;
+        for (std::size_t i = 0; i < ns.size(); ++i)
+        {
+            double f = COMPLEXITY_MODELS[m].f(ns[i]);
+            sumft += f * times[i];
+            sumff += f * f;
+        }
+        if (sumff == 0) { continue; }
+
+        double coefficient = sumft / sumff;
+        double error = 0;
+        for (std::size_t i = 0; i < ns.size(); ++i)
+        {
+            double diff = times[i] - coefficient * COMPLEXITY_MODELS[m].f(ns[i]);
+            error += diff * diff;
+        }
+        double rms = (mean > 0) ? std::sqrt(error / ns.size()) / mean : 0;
+        if (rms < best.rms) { best = {m, coefficient, rms}; }
+    }
+    return best;
+}
+
+string json_string(string const& text)
+{
+    string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\') { result += '\\'; }
+        result += c;
+    }
+    return result + '"';
+}
+}
+
 void MainProgram::test_get_functions(AffiliationID id)
 {
     ds_.get_affiliation_name(id);
@@ -140,7 +376,7 @@ MainProgram::CmdResult MainProgram::cmd_add_affiliation(ostream& /*output*/, Mat
     int x = convert_string_to<int>(xstr);
     int y = convert_string_to<int>(ystr);
 
-    bool success = ds_.add_affiliation(id, name, {x, y});
+    bool success = ds_.add_affiliation(id, std::move(name), {x, y});
 
     view_dirty = true;
     return {ResultType::IDLIST, CmdResultIDs{{}, {success ? id : NO_AFFILIATION}}};
@@ -373,6 +609,20 @@ MainProgram::CmdResult MainProgram::cmd_get_direct_references(std::ostream &outp
     return {ResultType::IDLIST, CmdResultIDs{references, {}}};
 }
 
+MainProgram::CmdResult MainProgram::cmd_get_ancestor_at_depth(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID pubid = convert_string_to<PublicationID>(*begin++);
+    unsigned int depth = convert_string_to<unsigned int>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto ancestorid = ds_.get_ancestor_at_depth(pubid, depth);
+    if (ancestorid != NO_PUBLICATION) {
+        return {ResultType::IDLIST, CmdResultIDs{{ancestorid},{}}};
+    }
+    output << "No such depth or publication doesn't exist." << std::endl;
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_get_publications(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     AffiliationID id = *begin++;
@@ -402,6 +652,47 @@ void MainProgram::test_get_all_references()
     }
 }
 
+void MainProgram::test_count_all_references()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        auto id = random_root_publication();
+        ds_.count_all_references(id);
+    }
+}
+
+void MainProgram::test_get_all_references_dfs()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        auto id = random_root_publication();
+        ds_.get_all_references_dfs(id);
+    }
+}
+
+void MainProgram::test_get_citation_depth()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        auto id = random_publication();
+        ds_.get_citation_depth(id);
+    }
+}
+
+void MainProgram::test_get_subtree_size()
+{
+    if (random_publications_added_ > 0) // Don't do anything if there's no publications
+    {
+        auto id = random_root_publication();
+        ds_.get_subtree_size(id);
+    }
+}
+
+void MainProgram::test_get_most_cited()
+{
+    ds_.get_most_cited(10);
+}
+
 MainProgram::CmdResult MainProgram::cmd_remove_affiliation(ostream& output, MatchIter begin, MatchIter end)
 {
     string id = *begin++;
@@ -439,7 +730,7 @@ void MainProgram::add_random_affiliations_publications(unsigned int size, Coord
             auto name = n_to_name(random_affiliations_added_);
             AffiliationID id = n_to_affiliationid(random_affiliations_added_);
 
-            ds_.add_affiliation(id, name, get_random_coords(min, max));
+            ds_.add_affiliation(std::move(id), std::move(name), get_random_coords(min, max));
 
             ++random_affiliations_added_;
         }
@@ -449,7 +740,7 @@ void MainProgram::add_random_affiliations_publications(unsigned int size, Coord
             auto name = n_to_name(random_affiliations_added_);
             AffiliationID id = n_to_affiliationid(random_affiliations_added_);
 
-            ds_.add_affiliation(id, name, coordinates.at(i));
+            ds_.add_affiliation(std::move(id), std::move(name), coordinates.at(i));
 
             ++random_affiliations_added_;
         }
@@ -460,6 +751,7 @@ void MainProgram::add_random_affiliations_publications(unsigned int size, Coord
         auto publicationid = n_to_publicationid(random_publications_added_);
 
         vector<AffiliationID> affiliations;
+        affiliations.reserve(4);
         for (int j=0; j<4; ++j)
         {
             affiliations.push_back(random_affiliation());
@@ -573,6 +865,14 @@ void MainProgram::test_get_direct_references()
     }
 }
 
+void MainProgram::test_get_ancestor_at_depth()
+{
+    if (random_publications_added_ > 0) {
+        auto publicationid = random_leaf_publication();
+        ds_.get_ancestor_at_depth(publicationid, random<unsigned int>(0, 32));
+    }
+}
+
 void MainProgram::test_get_affiliations()
 {
     if (random_publications_added_ > 0) {
@@ -649,6 +949,33 @@ void MainProgram::test_get_shortest_path()
     }
 }
 
+void MainProgram::test_get_shortest_paths_from()
+{
+    if (random_publications_added_ > 0 ){
+        auto fromid = random_affiliation();
+        vector<AffiliationID> toids;
+        for (unsigned int i = 0; i < PATH_BATCH_SIZE; ++i) { toids.push_back(random_affiliation()); }
+        ds_.get_shortest_paths_from(fromid, toids);
+    }
+}
+
+void MainProgram::test_get_path_with_least_affiliations_batch()
+{
+    if (random_publications_added_ > 0 ){
+        vector<pair<AffiliationID, AffiliationID>> pairs;
+        for (unsigned int i = 0; i < PATH_BATCH_SIZE; ++i) { pairs.emplace_back(random_affiliation(), random_affiliation()); }
+        ds_.get_path_with_least_affiliations_batch(pairs);
+    }
+}
+
+void MainProgram::test_get_hop_distances()
+{
+    if (random_affiliations_added_ > 0)
+    {
+        ds_.get_hop_distances(random_affiliation());
+    }
+}
+
 Coord MainProgram::get_random_coords(const Coord min, const Coord max)
 {
     int x = random<int>(min.x, max.x);
@@ -682,7 +1009,7 @@ std::vector<Coord> MainProgram::get_unique_coords(const unsigned int n, const st
             }
         }
         // and get the required number of random_coordinates
-        std::shuffle(retvec.begin(),retvec.end(),rand_engine_);
+        std::shuffle(retvec.begin(),retvec.end(),rand_engine());
         retvec.erase(std::next(retvec.begin(),n),retvec.end());
         return retvec;
     } else {
@@ -730,20 +1057,21 @@ MainProgram::CmdResult MainProgram::cmd_add_publication(std::ostream& /*output*/
     PublicationID id = convert_string_to<PublicationID>(*begin++);
     string name = *begin++;
     Year year = convert_string_to<Year>(*begin++);
-    string affilsstr = *begin++;
+    std::string_view affilsstr = (begin++)->text;
 
     assert( begin == end && "Impossible number of parameters!");
 
     vector<AffiliationID> affiliations;
 
-    smatch affil;
-    auto sbeg = affilsstr.cbegin();
-    auto send = affilsstr.cend();
-    for ( ; regex_search(sbeg, send, affil, affil_regex_); sbeg = affil.suffix().first)
+    // The list has already been validated, so splitting it at whitespace is enough
+    std::size_t pos = 0;
+    while ((pos = affilsstr.find_first_not_of(SPACE_CHARS, pos)) != std::string_view::npos)
     {
-        affiliations.push_back(affil[1]);
+        std::size_t last = affilsstr.find_first_of(SPACE_CHARS, pos);
+        affiliations.emplace_back(affilsstr.substr(pos, last - pos));
+        pos = last;
     }
-    bool success = ds_.add_publication(id, name, year, affiliations);
+    bool success = ds_.add_publication(id, std::move(name), year, std::move(affiliations));
 
     view_dirty = true;
     return {ResultType::IDLIST, CmdResultIDs{{success ? id : NO_PUBLICATION}, {}}};
@@ -787,6 +1115,81 @@ MainProgram::CmdResult MainProgram::cmd_get_all_references(std::ostream &output,
     return {ResultType::IDLIST, CmdResultIDs{references, {}}};
 }
 
+MainProgram::CmdResult MainProgram::cmd_count_all_references(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID publicationid = convert_string_to<PublicationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto count = ds_.count_all_references(publicationid);
+    if (count == NO_COUNT)
+    {
+        return {ResultType::IDLIST, CmdResultIDs{{NO_PUBLICATION}, {}}};
+    }
+
+    output << "Number of references: " << count << endl;
+    return {ResultType::IDLIST, CmdResultIDs{{publicationid}, {}}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_all_references_dfs(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID publicationid = convert_string_to<PublicationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto references = ds_.get_all_references_dfs(publicationid);
+    if (references.empty())
+    {
+        output << "No (direct) references!" << endl;
+    }
+
+    std::sort(references.begin(), references.end());
+    references.insert(references.begin(), publicationid); // Add parameter as the first publication
+    return {ResultType::IDLIST, CmdResultIDs{references, {}}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_citation_depth(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID publicationid = convert_string_to<PublicationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto depth = ds_.get_citation_depth(publicationid);
+    if (depth == NO_COUNT)
+    {
+        return {ResultType::IDLIST, CmdResultIDs{{NO_PUBLICATION}, {}}};
+    }
+
+    output << "Citation depth: " << depth << endl;
+    return {ResultType::IDLIST, CmdResultIDs{{publicationid}, {}}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_subtree_size(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    PublicationID publicationid = convert_string_to<PublicationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto size = ds_.get_subtree_size(publicationid);
+    if (size == NO_COUNT)
+    {
+        return {ResultType::IDLIST, CmdResultIDs{{NO_PUBLICATION}, {}}};
+    }
+
+    output << "Subtree size: " << size << endl;
+    return {ResultType::IDLIST, CmdResultIDs{{publicationid}, {}}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_get_most_cited(std::ostream &output, MatchIter begin, MatchIter end)
+{
+    unsigned int count = convert_string_to<unsigned int>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto publications = ds_.get_most_cited(count);
+    if (publications.empty())
+    {
+        output << "No publications!" << endl;
+    }
+
+    return {ResultType::IDLIST, CmdResultIDs{publications, {}}};
+}
+
 Distance MainProgram::calc_distance(Coord c1, Coord c2)
 {
     if (c1 == NO_COORD || c2 == NO_COORD) { return NO_DISTANCE; }
@@ -810,6 +1213,30 @@ MainProgram::CmdResult MainProgram::cmd_clear_all(ostream& output, MatchIter beg
     return {};
 }
 
+MainProgram::CmdResult MainProgram::cmd_begin_bulk_load(ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    ds_.begin_bulk_load();
+
+    output << "Bulk load started, indices are built at end_bulk_load" << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_end_bulk_load(ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    ds_.end_bulk_load();
+
+    output << "Bulk load finished" << endl;
+
+    view_dirty = true;
+
+    return {};
+}
+
 string MainProgram::print_affiliation(AffiliationID id, ostream& output, bool nl)
 {
     try
@@ -1063,38 +1490,116 @@ MainProgram::CmdResult MainProgram::cmd_get_shortest_path(std::ostream &output,
     return {ResultType::ROUTE, path};
 }
 
-AffiliationID MainProgram::random_affiliation()
+MainProgram::CmdResult MainProgram::cmd_get_shortest_paths_from(std::ostream &output, MatchIter begin, MatchIter end)
 {
-    return n_to_affiliationid(random<decltype(random_affiliations_added_)>(0, random_affiliations_added_));
-}
+    auto sourceid = convert_string_to<AffiliationID>(*begin++);
+    vector<AffiliationID> targets = split_affiliation_list((begin++)->text);
+    assert( begin == end && "Impossible number of parameters!");
 
-PublicationID MainProgram::random_publication()
-{
-    return n_to_publicationid(random<decltype(random_publications_added_)>(0, random_publications_added_));
+    auto routes = ds_.get_shortest_paths_from(sourceid, targets);
+    for (std::size_t i = 0; i < targets.size() && i < routes.size(); ++i)
+    {
+        output << sourceid << " -> " << targets[i] << ": ";
+        if (routes[i].empty())
+        {
+            output << "No route found!" << endl;
+            continue;
+        }
+        Distance distance = 0;
+        for (auto const& connection : routes[i]) { distance += connection.second; }
+        output << routes[i].size() << " connection(s), distance " << distance << endl;
+    }
+    return {};
 }
 
-PublicationID MainProgram::random_root_publication()
+MainProgram::CmdResult MainProgram::cmd_get_path_with_least_affiliations_batch(std::ostream &output, MatchIter begin, MatchIter end)
 {
-    unsigned long end = ROOT_BIAS_MULTIPLIER * random_publications_added_;
-    if (end == 0 ) {
-        return 0;
+    auto sourceid = convert_string_to<AffiliationID>(*begin++);
+    auto targetid = convert_string_to<AffiliationID>(*begin++);
+    vector<AffiliationID> rest = split_affiliation_list((begin++)->text);
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (rest.size() % 2 != 0)
+    {
+        output << "Affiliation IDs must come in source target pairs!" << endl;
+        return {};
     }
-    return n_to_publicationid(random<decltype(random_publications_added_)>(0, end));
-}
+    vector<pair<AffiliationID, AffiliationID>> pairs = {{sourceid, targetid}};
+    for (std::size_t i = 0; i < rest.size(); i += 2) { pairs.emplace_back(rest[i], rest[i + 1]); }
 
-PublicationID MainProgram::random_leaf_publication()
-{
-    unsigned long start = LEAF_BIAS_MULTIPLIER * random_publications_added_;
-    if (start == random_publications_added_) {
-        start = 0;
+    auto routes = ds_.get_path_with_least_affiliations_batch(pairs);
+    for (std::size_t i = 0; i < pairs.size() && i < routes.size(); ++i)
+    {
+        output << pairs[i].first << " -> " << pairs[i].second << ": ";
+        if (routes[i].empty())
+        {
+            output << "No route found!" << endl;
+            continue;
+        }
+        output << routes[i].size() << " connection(s)" << endl;
     }
-    return n_to_publicationid(random<decltype(random_publications_added_)>(start, random_publications_added_));
+    return {};
 }
 
-void MainProgram::test_find_affiliation_with_coord()
+MainProgram::CmdResult MainProgram::cmd_get_hop_distances(std::ostream &output, MatchIter begin, MatchIter end)
 {
-    ds_.find_affiliation_with_coord(get_random_coords());
-}
+    auto sourceid = convert_string_to<AffiliationID>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto distances = ds_.get_hop_distances(sourceid);
+    if (distances.empty())
+    {
+        output << "Failed (NO_AFFILIATION returned)!" << endl;
+        return {};
+    }
+
+    // The distribution of hop counts, the last one is the eccentricity of the source
+    vector<unsigned long> counts;
+    for (auto const& distance : distances)
+    {
+        if (distance.second >= counts.size()) { counts.resize(distance.second + 1); }
+        ++counts[distance.second];
+    }
+    output << "Reached " << distances.size() << " affiliation(s) from " << sourceid << ", eccentricity " << counts.size() - 1 << endl;
+    for (std::size_t hops = 0; hops < counts.size(); ++hops)
+    {
+        output << "  " << hops << " hop(s): " << counts[hops] << endl;
+    }
+    return {};
+}
+
+AffiliationID MainProgram::random_affiliation()
+{
+    return n_to_affiliationid(random<decltype(random_affiliations_added_)>(0, random_affiliations_added_));
+}
+
+PublicationID MainProgram::random_publication()
+{
+    return n_to_publicationid(random<decltype(random_publications_added_)>(0, random_publications_added_));
+}
+
+PublicationID MainProgram::random_root_publication()
+{
+    unsigned long end = ROOT_BIAS_MULTIPLIER * random_publications_added_;
+    if (end == 0 ) {
+        return 0;
+    }
+    return n_to_publicationid(random<decltype(random_publications_added_)>(0, end));
+}
+
+PublicationID MainProgram::random_leaf_publication()
+{
+    unsigned long start = LEAF_BIAS_MULTIPLIER * random_publications_added_;
+    if (start == random_publications_added_) {
+        start = 0;
+    }
+    return n_to_publicationid(random<decltype(random_publications_added_)>(start, random_publications_added_));
+}
+
+void MainProgram::test_find_affiliation_with_coord()
+{
+    ds_.find_affiliation_with_coord(get_random_coords());
+}
 
 void MainProgram::test_publication_info()
 {
@@ -1129,6 +1634,7 @@ MainProgram::CmdResult MainProgram::cmd_randseed(std::ostream& output, MatchIter
     unsigned long int seed = convert_string_to<unsigned long int>(seedstr);
 
     rand_engine_.seed(seed);
+    random_seed_ = seed;
     init_primes();
 
     output << "Random seed set to " << seed << endl;
@@ -1140,12 +1646,14 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
 {
     string filename = *begin++;
     string silentstr =  *begin++;
+    string parallelstr = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
     bool silent = !silentstr.empty();
+    bool fast = (silentstr == "fast");
     ostream* new_output = &output;
 
-    ostringstream dummystr; // Given as output if "silent" is specified, the output is discarded
+    ostream dummystr(nullptr); // Given as output if "silent" or "fast" is specified, the output is discarded
     if (silent)
     {
         new_output = &dummystr;
@@ -1155,8 +1663,9 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
     if (input)
     {
         output << "** Commands from '" << filename << "'" << endl;
-        command_parser(input, *new_output, PromptStyle::NORMAL);
-        if (silent) { output << "...(output discarded in silent mode)..." << endl; }
+        file_command_parser(input, *new_output, fast ? PromptStyle::NO_PROMPT : PromptStyle::NORMAL, !parallelstr.empty());
+        if (fast) { output << "...(output discarded in fast mode)..." << endl; }
+        else if (silent) { output << "...(output discarded in silent mode)..." << endl; }
         output << "** End of commands from '" << filename << "'" << endl;
     }
     else
@@ -1168,6 +1677,301 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
 }
 
 
+MainProgram::CmdResult MainProgram::cmd_save_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    ofstream file(filename, ios::binary);
+    if (file && ds_.save_snapshot(file))
+    {
+        output << "Saved snapshot to '" << filename << "'" << endl;
+    }
+    else
+    {
+        output << "Cannot write snapshot to file '" << filename << "'!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_load_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    ifstream file(filename, ios::binary);
+    if (!file)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+    }
+    else if (ds_.load_snapshot(file))
+    {
+        output << "Loaded snapshot from '" << filename << "': " << ds_.get_affiliation_count() << " affiliations, "
+               << ds_.all_publications().size() << " publications" << endl;
+    }
+    else
+    {
+        output << "File '" << filename << "' is not a valid snapshot!" << endl;
+    }
+
+    view_dirty = true;
+
+    return {};
+}
+
+
+MainProgram::CmdResult MainProgram::cmd_save_image(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    ofstream file(filename, ios::binary);
+    if (file && ds_.save_image(file))
+    {
+        output << "Saved read-only image to '" << filename << "'" << endl;
+    }
+    else
+    {
+        output << "Cannot write image to file '" << filename << "'!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_open_image(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (ds_.open_image(filename))
+    {
+        output << "Opened read-only image '" << filename << "': " << ds_.get_affiliation_count() << " affiliations, "
+               << ds_.all_publications().size() << " publications" << endl;
+    }
+    else
+    {
+        output << "File '" << filename << "' is not a valid image!" << endl;
+    }
+
+    view_dirty = true;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_close_image(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    ds_.close_image();
+
+    output << "Closed read-only image" << endl;
+
+    view_dirty = true;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_open_wal(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string syncstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    // By default every record is synced, larger batches trade durability for speed
+    unsigned int syncevery = syncstr.empty() ? 1 : convert_string_to<unsigned int>(syncstr);
+
+    if (ds_.open_wal(filename, syncevery))
+    {
+        output << "Opened write-ahead log '" << filename << "': " << ds_.get_affiliation_count() << " affiliations, "
+               << ds_.all_publications().size() << " publications" << endl;
+    }
+    else
+    {
+        output << "Cannot replay write-ahead log '" << filename << "'!" << endl;
+    }
+
+    view_dirty = true;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_sync_wal(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    if (ds_.sync_wal())
+    {
+        output << "Write-ahead log synced" << endl;
+    }
+    else
+    {
+        output << "Cannot sync write-ahead log (none open or writing failed)!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_close_wal(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    ds_.close_wal();
+
+    output << "Closed write-ahead log" << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_memory_stats(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    auto usage = ds_.memory_usage();
+    std::size_t total = 0;
+    for (auto& structure : usage) { total += structure.bytes; }
+
+    output << "Memory used by the data structures:" << endl;
+    for (auto& structure : usage)
+    {
+        output << "  " << std::left << setw(28) << structure.structure << std::right << setw(14) << structure.bytes << " bytes" << endl;
+    }
+    output << "  " << std::left << setw(28) << "total" << std::right << setw(14) << total << " bytes" << endl;
+    output << "  " << std::left << setw(28) << "node arena" << std::right << setw(14) << ds_.node_arena_bytes()
+           << " bytes (held by the affiliation and publication pools)" << endl;
+
+    auto [peraffiliation, perpublication] = memory_per_entry();
+    output << "Bytes per affiliation: " << peraffiliation << ", bytes per publication: " << perpublication << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_set_threads(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    unsigned int threads = convert_string_to<unsigned int>(*begin++);
+    assert(begin == end && "Invalid number of parameters");
+
+    // The workers are replaced only once the chunks parallel file readers have queued are parsed,
+    // the readers go on parsing ahead with the new thread count
+    wait_file_parsing();
+
+    // 0 goes back to one thread per core
+    Scheduler& scheduler = Scheduler::instance();
+    scheduler.set_thread_count(threads);
+    output << "Parallel operations use " << scheduler.thread_count() << " thread(s)" << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_scheduler_stats(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    // Statistics cover the time since the previous scheduler_stats or set_threads
+    Scheduler& scheduler = Scheduler::instance();
+    auto stats = scheduler.stats();
+    double seconds = scheduler.stats_seconds();
+    scheduler.reset_stats();
+
+    output << "Scheduler with " << scheduler.thread_count() << " thread(s), statistics of the last " << seconds << " sec:" << endl;
+    for (std::size_t i = 0; i < stats.size(); ++i)
+    {
+        auto& worker = stats[i];
+        output << "  " << std::left << setw(10) << (i + 1 == stats.size() ? string("callers") : "worker " + std::to_string(i + 1)) << std::right
+               << " tasks " << setw(8) << worker.tasks << ", steals " << setw(8) << worker.steals
+               << ", busy " << setw(10) << worker.busySeconds << " sec";
+        if (i + 1 < stats.size() && seconds > 0)
+        {
+            output << " (" << 100 * worker.busySeconds / seconds << "% utilization)";
+        }
+        output << endl;
+    }
+
+    return {};
+}
+
+std::pair<double, double> MainProgram::memory_per_entry()
+{
+    // Each structure is charged to the kind of entry it grows with
+    double affiliationbytes = 0;
+    double publicationbytes = 0;
+    for (auto& structure : ds_.memory_usage())
+    {
+        (structure.perPublication ? publicationbytes : affiliationbytes) += structure.bytes;
+    }
+    auto affiliations = ds_.get_affiliation_count();
+    auto publications = ds_.all_publications().size();
+    return {affiliations == 0 ? 0 : affiliationbytes / affiliations, publications == 0 ? 0 : publicationbytes / publications};
+}
+
+
+MainProgram::CmdResult MainProgram::cmd_import_csv(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string affiliationfile = *begin++;
+    string publicationfile = *begin++;
+    string referencefile = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    // The records go straight to the bulk loader, the indices are built once at the end
+    ds_.begin_bulk_load();
+
+    import_csv_file(output, affiliationfile, "Affiliations", "id,name,x,y",
+                    [this](std::string_view const* fields, std::size_t count) {
+        Coord xy = NO_COORD;
+        return count == 4 && is_csv_affiliation_id(fields[0]) && is_csv_name(fields[1]) &&
+               parse_csv_number(fields[2], xy.x) && parse_csv_number(fields[3], xy.y) &&
+               ds_.add_affiliation(AffiliationID(fields[0]), Name(fields[1]), xy);
+    });
+
+    import_csv_file(output, publicationfile, "Publications", "id,title,year,affiliations",
+                    [this](std::string_view const* fields, std::size_t count) {
+        PublicationID id = NO_PUBLICATION;
+        Year year = 0;
+        if ((count != 3 && count != 4) || !parse_csv_number(fields[0], id) || !is_csv_name(fields[1]) ||
+            !parse_csv_number(fields[2], year))
+        {
+            return false;
+        }
+
+        // Affiliations are separated by semicolons
+        vector<AffiliationID> affiliations;
+        std::string_view list = (count == 4) ? fields[3] : std::string_view();
+        for (std::size_t pos = 0; pos <= list.size(); )
+        {
+            std::size_t next = std::min(list.find(';', pos), list.size());
+            std::string_view affiliation = trim_csv_field(list.substr(pos, next - pos));
+            if (!affiliation.empty())
+            {
+                if (!is_csv_affiliation_id(affiliation)) { return false; }
+                affiliations.emplace_back(affiliation);
+            }
+            pos = next + 1;
+        }
+        return ds_.add_publication(id, Name(fields[1]), year, std::move(affiliations));
+    });
+
+    if (!referencefile.empty())
+    {
+        import_csv_file(output, referencefile, "References", "id,parentid",
+                        [this](std::string_view const* fields, std::size_t count) {
+            PublicationID id = NO_PUBLICATION;
+            PublicationID parentid = NO_PUBLICATION;
+            return count == 2 && parse_csv_number(fields[0], id) && parse_csv_number(fields[1], parentid) &&
+                   ds_.add_reference(id, parentid);
+        });
+    }
+
+    Stopwatch stopwatch;
+    stopwatch.start();
+    ds_.end_bulk_load();
+    stopwatch.stop();
+    output << "Indices built in " << stopwatch.elapsed() << " sec: " << ds_.get_affiliation_count() << " affiliations, "
+           << ds_.all_publications().size() << " publications" << endl;
+
+    view_dirty = true;
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_testread(std::ostream& output, MatchIter begin, MatchIter end)
 {
     string infilename = *begin++;
@@ -1380,6 +2184,8 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
 {
     {"get_affiliation_count", "", "", &MainProgram::cmd_get_affiliation_count, &MainProgram::test_get_affiliation_count },
     {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr }, // clear all probably shouldn't be perftested since it will ... clear everything
+    {"begin_bulk_load", "", "", &MainProgram::cmd_begin_bulk_load, nullptr },
+    {"end_bulk_load", "", "", &MainProgram::cmd_end_bulk_load, nullptr },
     {"get_all_affiliations", "", "", &MainProgram::cmd_get_all_affiliations, &MainProgram::NoParListTestCmd<&Datastructures::get_all_affiliations>},
     {"add_affiliation", "AffiliationID \"Name\" (x,y)", affiliationidx+wsx+'"'+namex+'"'+wsx+coordx, &MainProgram::cmd_add_affiliation, nullptr }, // tested within each perftest, separate perftesting not necessary
     {"affiliation_info", "AffiliationID", affiliationidx, &MainProgram::cmd_affiliation_info, &MainProgram::test_affiliation_info },
@@ -1396,6 +2202,11 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"add_affiliation_to_publication", "AffiliationID PublicationID", affiliationidx+wsx+publicationidx, &MainProgram::cmd_add_affiliation_to_publication, &MainProgram::test_add_affiliation_to_publication},
     {"get_publications", "AffiliationID", affiliationidx, &MainProgram::cmd_get_publications, &MainProgram::test_get_publications },
     {"get_all_references", "PublicationID", publicationidx, &MainProgram::cmd_get_all_references, &MainProgram::test_get_all_references },
+    {"count_all_references", "PublicationID", publicationidx, &MainProgram::cmd_count_all_references, &MainProgram::test_count_all_references },
+    {"get_all_references_dfs", "PublicationID", publicationidx, &MainProgram::cmd_get_all_references_dfs, &MainProgram::test_get_all_references_dfs },
+    {"get_citation_depth", "PublicationID", publicationidx, &MainProgram::cmd_get_citation_depth, &MainProgram::test_get_citation_depth },
+    {"get_subtree_size", "PublicationID", publicationidx, &MainProgram::cmd_get_subtree_size, &MainProgram::test_get_subtree_size },
+    {"get_most_cited", "count", numx, &MainProgram::cmd_get_most_cited, &MainProgram::test_get_most_cited },
     {"get_affiliations_closest_to", "(x,y)", coordx, &MainProgram::cmd_get_affiliations_closest_to, &MainProgram::test_affiliations_closest_to },
     {"remove_affiliation", "AffiliationID", affiliationidx, &MainProgram::cmd_remove_affiliation, &MainProgram::test_remove_affiliation },
     {"get_closest_common_parent", "PublicationID1 PublicationID2", publicationidx+wsx+publicationidx, &MainProgram::cmd_get_closest_common_parent, &MainProgram::test_get_closest_common_parent },
@@ -1403,10 +2214,30 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"help", "", "", &MainProgram::help_command, nullptr },
     {"random_add", "number_of_affiliations_to_add  (minx,miny) (maxx,maxy) (coordinates optional)",
      numx+"(?:"+wsx+coordx+wsx+coordx+")?", &MainProgram::cmd_random_affiliations, &MainProgram::test_random_affiliations },
-    {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
+    {"read", "\"in-filename\" [silent|fast] [parallel] (parts in [] are optional, alternatives separated by |)",
+     "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent|fast))?(?:"+wsx+"(parallel))?", &MainProgram::cmd_read, nullptr },
+    {"import_csv", "\"affiliations-file\" \"publications-file\" [\"references-file\"] (parts in [] are optional)",
+     "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"\"([-a-zA-Z0-9 ./:_]+)\")?", &MainProgram::cmd_import_csv, nullptr },
     {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
-    {"perftest", "cmd1[;cmd2...] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
-     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
+    {"save_snapshot", "\"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_save_snapshot, nullptr },
+    {"load_snapshot", "\"in-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_load_snapshot, nullptr },
+    {"save_image", "\"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_save_image, nullptr },
+    {"open_image", "\"in-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_open_image, nullptr },
+    {"close_image", "", "", &MainProgram::cmd_close_image, nullptr },
+    {"open_wal", "\"log-filename\" [records_per_sync]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+numx+")?", &MainProgram::cmd_open_wal, nullptr },
+    {"sync_wal", "", "", &MainProgram::cmd_sync_wal, nullptr },
+    {"close_wal", "", "", &MainProgram::cmd_close_wal, nullptr },
+    {"memory_stats", "", "", &MainProgram::cmd_memory_stats, nullptr },
+    {"set_threads", "number_of_threads (0 = one per core)", numx, &MainProgram::cmd_set_threads, nullptr },
+    {"scheduler_stats", "", "", &MainProgram::cmd_scheduler_stats, nullptr },
+    {"perftest", "cmd1[;cmd2...] timeout repeat_count n1[;n2...] [csv|json \"out-filename\"] (parts in [] are optional, alternatives separated by |)",
+     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)(?:"+wsx+"(csv|json)"+wsx+"\"([-a-zA-Z0-9 ./:_]+)\")?",
+     &MainProgram::cmd_perftest, nullptr },
+    {"perftest_concurrent", "cmd1[;cmd2...] timeout repeat_count n1[;n2...] [threads1[;threads2...]] (parts in [] are optional)",
+     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)(?:"+wsx+"([0-9]+(?:;[0-9]+)*))?",
+     &MainProgram::cmd_perftest_concurrent, nullptr },
+    {"concurrency_test", "number_of_affiliations publications_to_add reader_threads [mutations_per_version] (parts in [] are optional)",
+     numx+wsx+numx+wsx+numx+"(?:"+wsx+numx+")?", &MainProgram::cmd_concurrency_test, nullptr },
     {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
     {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
     {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
@@ -1415,6 +2246,7 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"get_referenced_by_chain","PublicationID",publicationidx,&MainProgram::cmd_get_referenced_by_chain,&MainProgram::test_get_referenced_by_chain},
     {"get_affiliations", "PublicationID", publicationidx, &MainProgram::cmd_get_affiliations, &MainProgram::test_get_affiliations},
     {"get_direct_references", "PublicationID", publicationidx, &MainProgram::cmd_get_direct_references, &MainProgram::test_get_direct_references},
+    {"get_ancestor_at_depth", "PublicationID Depth", publicationidx+wsx+numx, &MainProgram::cmd_get_ancestor_at_depth, &MainProgram::test_get_ancestor_at_depth},
     // prg2
     {"get_connected_affiliations","AffiliationID", affiliationidx, &MainProgram::cmd_get_connected_affiliations,&MainProgram::test_get_connected_affiliations},
     {"get_all_connections","","",&MainProgram::cmd_get_all_connections,&MainProgram::test_get_all_connections},
@@ -1423,6 +2255,12 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"get_path_with_least_affiliations", "AffiliationID AffiliationID", affiliationidx+wsx+affiliationidx,&MainProgram::cmd_get_path_with_least_affiliations,&MainProgram::test_get_path_with_least_affiliations},
     {"get_path_of_least_friction", "AffiliationID AffiliationID", affiliationidx+wsx+affiliationidx,&MainProgram::cmd_get_path_of_least_friction,&MainProgram::test_get_path_of_least_friction},
     {"get_shortest_path", "AffiliationID AffiliationID", affiliationidx+wsx+affiliationidx,&MainProgram::cmd_get_shortest_path,&MainProgram::test_get_shortest_path},
+    {"get_shortest_paths_from", "AffiliationID AffiliationID ...", affiliationidx+"((?:"+wsx+affiliationlistx+")*)",
+     &MainProgram::cmd_get_shortest_paths_from,&MainProgram::test_get_shortest_paths_from},
+    {"get_path_with_least_affiliations_batch", "AffiliationID AffiliationID [AffiliationID AffiliationID ...]",
+     affiliationidx+wsx+affiliationidx+"((?:"+wsx+affiliationlistx+")*)",
+     &MainProgram::cmd_get_path_with_least_affiliations_batch,&MainProgram::test_get_path_with_least_affiliations_batch},
+    {"get_hop_distances", "AffiliationID", affiliationidx, &MainProgram::cmd_get_hop_distances, &MainProgram::test_get_hop_distances},
 
 };
 
@@ -1450,6 +2288,8 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     unsigned int timeout = convert_string_to<unsigned int>(*begin++);
     unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
     string sizes = *begin++;
+    string reportformat = *begin++;
+    string reportfile = *begin++;
     assert(begin == end && "Invalid number of parameters");
 
     vector<string> testcmds;
@@ -1472,10 +2312,12 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     }
 
     output << "Timeout for each N is " << timeout << " sec. " << endl;
+    output << "Parallel operations use " << Scheduler::instance().thread_count() << " thread(s)" << endl;
     output << "For each N perform " << repeat_count << " random command(s) from:" << endl;
 
     // Initialize test functions
     vector<void(MainProgram::*)()> testfuncs;
+    vector<string> testnames;
 
     for (auto& i : testcmds)
     {
@@ -1484,6 +2326,7 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         {
             output << i << " ";
             testfuncs.push_back(pos->testfunc);
+            testnames.push_back(i);
         }
         else
         {
@@ -1508,6 +2351,9 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
 #endif
     flush_output(output);
 
+    // Results of each N, for the complexity fits and the report file
+    vector<PerftestResult> results;
+
     auto stop = false;
     for (unsigned int n : init_ns)
     {
@@ -1554,7 +2400,8 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         }
 
 #ifdef USE_PERF_EVENT
-        auto addcount = stopwatch.count();
+        auto addcounts = stopwatch.counts();
+        auto addcount = addcounts[PERF_INSTRUCTIONS];
 #endif
         auto addsec = stopwatch.elapsed();
 
@@ -1571,12 +2418,23 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
             break;
         }
 
+        // Latency of each call in nanoseconds, separately for each command
+        vector<LatencyHistogram> latencies(testfuncs.size());
+
+        // The scheduler's own statistics are left for scheduler_stats, this round is measured from a baseline
+        auto schedulerstats = Scheduler::instance().stats();
+        double schedulerseconds = Scheduler::instance().stats_seconds();
+
         stopwatch.start();
         for (unsigned int repeat = 0; repeat < repeat_count; ++repeat)
         {
             auto cmdpos = random(testfuncs.begin(), testfuncs.end());
 
+            auto callstart = std::chrono::steady_clock::now();
             (this->**cmdpos)();
+            auto callend = std::chrono::steady_clock::now();
+            latencies[cmdpos - testfuncs.begin()].record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(callend - callstart).count());
 
             if (repeat % 10 == 0)
             {
@@ -1600,7 +2458,13 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         if (stop) { break; }
 
 #ifdef USE_PERF_EVENT
-        auto totalcount = stopwatch.count();
+        auto totalcounts = stopwatch.counts();
+        auto totalcount = totalcounts[PERF_INSTRUCTIONS];
+        PerfCounts cmdcounts;
+        for (std::size_t i = 0; i < cmdcounts.size(); ++i)
+        {
+            cmdcounts[i] = (totalcounts[i] < 0) ? -1 : totalcounts[i] - addcounts[i];
+        }
 #endif
         auto totalsec = stopwatch.elapsed();
 
@@ -1611,7 +2475,40 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
 #endif
 
         output << endl;
+#ifdef USE_PERF_EVENT
+        output << setw(7) << "" << "   add:  ";
+        print_perf_counts(output, addcounts);
+        output << endl << setw(7) << "" << "   cmds: ";
+        print_perf_counts(output, cmdcounts);
+        output << endl;
+#endif
+        auto [peraffiliation, perpublication] = memory_per_entry();
+        output << setw(7) << "" << "   memory: " << peraffiliation << " bytes/affiliation, " << perpublication << " bytes/publication" << endl;
+        print_scheduler_use(output, schedulerstats, schedulerseconds);
+        print_latencies(output, testnames, latencies);
         flush_output(output);
+
+        PerftestResult result{n, addsec, totalsec-addsec, totalsec, {}, {}, peak_rss_kb(), peraffiliation, perpublication,
+                              std::move(latencies)};
+#ifdef USE_PERF_EVENT
+        result.addcounts = addcounts;
+        result.cmdcounts = cmdcounts;
+#endif
+        results.push_back(std::move(result));
+    }
+
+    print_complexity_fits(output, testnames, results);
+
+    if (!reportfile.empty())
+    {
+        if (write_perftest_report(reportfile, reportformat == "json", timeout, repeat_count, testnames, results))
+        {
+            output << "Results of " << results.size() << " N(s) written to '" << reportfile << "'" << endl;
+        }
+        else
+        {
+            output << "Cannot write file '" << reportfile << "'!" << endl;
+        }
     }
 
     ds_.clear_all();
@@ -1633,231 +2530,862 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
+char const* const MainProgram::PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+void MainProgram::print_perf_counts(std::ostream& output, PerfCounts const& counts)
 {
-    return {};
+    // Instructions per cycle and misses per thousand instructions tell more than the raw counts
+    auto instructions = counts[PERF_INSTRUCTIONS];
+    output << "instructions " << instructions;
+    if (counts[PERF_CYCLES] > 0)
+    {
+        output << ", cycles " << counts[PERF_CYCLES] << " (IPC " << static_cast<double>(instructions) / counts[PERF_CYCLES] << ")";
+    }
+    for (auto counter : {PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES})
+    {
+        if (counts[counter] < 0) { continue; }
+        output << ", " << PERF_COUNTER_NAMES[counter] << " " << counts[counter];
+        if (instructions > 0) { output << " (" << 1000.0 * counts[counter] / instructions << "/kinstr)"; }
+    }
 }
 
-
-bool MainProgram::command_parse_line(string inputline, ostream& output)
+void MainProgram::print_scheduler_use(std::ostream& output, std::vector<Scheduler::WorkerStats> const& before, double beforeseconds)
 {
+    // How much of the commands' work the parallel operations spread over the workers
+    Scheduler& scheduler = Scheduler::instance();
+    auto stats = scheduler.stats();
+    double seconds = scheduler.stats_seconds() - beforeseconds;
+    unsigned long tasks = 0;
+    unsigned long steals = 0;
+    double busy = 0;
+    for (std::size_t i = 0; i < stats.size(); ++i)
+    {
+        tasks += stats[i].tasks - before[i].tasks;
+        steals += stats[i].steals - before[i].steals;
+        if (i + 1 < stats.size()) { busy += stats[i].busySeconds - before[i].busySeconds; }
+    }
+    output << setw(7) << "" << "   scheduler: " << scheduler.thread_count() << " thread(s), " << tasks << " tasks, " << steals << " steals";
+    if (stats.size() > 1 && seconds > 0)
+    {
+        output << ", workers " << 100 * busy / ((stats.size() - 1) * seconds) << "% busy";
+    }
+    output << endl;
+}
 
-    if (inputline.empty()) { return true; }
+void MainProgram::print_latencies(std::ostream& output, vector<string> const& names, vector<LatencyHistogram> const& latencies)
+{
+    auto micros = [](std::uint64_t nanoseconds){ return nanoseconds / 1000.0; };
+    std::size_t namewidth = 0;
+    for (auto& name : names) { namewidth = std::max(namewidth, name.size()); }
 
-    smatch match;
-    bool matched = regex_match(inputline, match, cmds_regex_);
-    if (matched)
+    auto precision = output.precision(4);
+    output << setw(7) << "" << "   " << std::left << setw(namewidth + 2) << "latency (usec)" << std::right
+           << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "p99.9"
+           << setw(10) << "max" << setw(10) << "calls" << endl;
+    for (std::size_t i = 0; i < latencies.size(); ++i)
     {
-        assert(match.size() == 3);
-        string cmd = match[1];
-        string params = match[2];
+        auto& histogram = latencies[i];
+        if (histogram.count() == 0) { continue; }
+        output << setw(7) << "" << "   " << std::left << setw(namewidth + 2) << names[i] << std::right
+               << setw(10) << micros(histogram.percentile(0.5)) << setw(10) << micros(histogram.percentile(0.9))
+               << setw(10) << micros(histogram.percentile(0.99)) << setw(10) << micros(histogram.percentile(0.999))
+               << setw(10) << micros(histogram.max()) << setw(10) << histogram.count() << endl;
+    }
+    output.precision(precision);
+}
 
-        auto pos = find_if(cmds_.begin(), cmds_.end(), [cmd](CmdInfo const& ci) { return ci.cmd == cmd; });
-        assert(pos != cmds_.end());
+void MainProgram::print_complexity_fits(std::ostream& output, vector<string> const& names, vector<PerftestResult> const& results)
+{
+    if (results.size() < 3)
+    {
+        if (results.size() == 2) { output << "(Complexity fit needs at least 3 values of N)" << endl; }
+        return;
+    }
 
-        smatch match2;
-        bool matched2 = regex_match(params, match2, pos->param_regex);
-        if (matched2)
-        {
-            if (pos->func)
-            {
-                assert(!match2.empty());
+    std::size_t namewidth = std::string("add (per affiliation)").size();
+    for (auto& name : names) { namewidth = std::max(namewidth, name.size()); }
 
-                Stopwatch stopwatch(true);
-                bool use_stopwatch = (stopwatch_mode != StopwatchMode::OFF);
-                // Reset stopwatch mode if only for the next command
-                if (stopwatch_mode == StopwatchMode::NEXT) { stopwatch_mode = StopwatchMode::OFF; }
+    auto print_fit = [&output, namewidth](string const& name, vector<double> const& ns, vector<double> const& times)
+    {
+        if (ns.size() < 3) { return; }
+        auto fit = fit_complexity(ns, times);
+        output << "   " << std::left << setw(namewidth + 2) << name << setw(12) << COMPLEXITY_MODELS[fit.model].name << std::right
+               << " c = " << setw(12) << fit.coefficient << " sec, rms error " << setw(5) << std::lround(fit.rms * 100) << "%";
+        // Per call, anything linear or worse defeats the point of the data structures
+        if (fit.model >= 2) { output << "  <-- linear or worse"; }
+        output << endl;
+    };
 
-               TestStatus initial_status = test_status_;
-               test_status_ = TestStatus::NOT_RUN;
+    output << endl << "Complexity fit (time per call against N):" << endl;
 
-                if (use_stopwatch)
-                {
-                    stopwatch.start();
-                }
+    vector<double> ns;
+    vector<double> times;
+    for (auto& result : results)
+    {
+        ns.push_back(result.n);
+        times.push_back(result.n > 0 ? result.addsec / result.n : 0);
+    }
+    print_fit("add (per affiliation)", ns, times);
+
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        ns.clear();
+        times.clear();
+        for (auto& result : results)
+        {
+            auto& histogram = result.latencies[i];
+            if (histogram.count() == 0) { continue; }
+            ns.push_back(result.n);
+            times.push_back(histogram.mean() / 1e9);
+        }
+        print_fit(names[i], ns, times);
+    }
+}
 
-                CmdResult result;
-                try
+bool MainProgram::write_perftest_report(string const& filename, bool json, unsigned int timeout, unsigned int repeat_count,
+                                        vector<string> const& names, vector<PerftestResult> const& results)
+{
+    // Build information, so that results of different builds can be told apart
+#if defined(__GNUC__) && !defined(__clang__)
+    string compiler = "GCC " __VERSION__;
+#elif defined(__VERSION__)
+    string compiler = __VERSION__;
+#elif defined(_MSC_VER)
+    string compiler = "MSVC " + std::to_string(_MSC_VER);
+#else
+    string compiler = "unknown";
+#endif
+    string flags = "c++" + std::to_string(__cplusplus);
+#ifdef __OPTIMIZE__
+    flags += " optimized";
+#endif
+#ifdef NDEBUG
+    flags += " NDEBUG";
+#endif
+#ifdef _GLIBCXX_DEBUG
+    flags += " _GLIBCXX_DEBUG";
+#endif
+#ifdef USE_PERF_EVENT
+    flags += " USE_PERF_EVENT";
+#endif
+#ifdef GIT_REVISION
+    string revision = GIT_REVISION;
+#else
+    string revision = "unknown";
+#endif
+
+    ofstream file(filename);
+    if (!file) { return false; }
+    file << std::setprecision(9);
+
+    double const percentiles[] = {0.5, 0.9, 0.99, 0.999};
+    char const* const percentilenames[] = {"p50", "p90", "p99", "p99.9"};
+
+    if (json)
+    {
+        file << "{\n  \"metadata\": {\"seed\": " << random_seed_ << ", \"compiler\": " << json_string(compiler)
+             << ", \"flags\": " << json_string(flags) << ", \"git_revision\": " << json_string(revision)
+             << ", \"threads\": " << Scheduler::instance().thread_count()
+             << ", \"timeout\": " << timeout << ", \"repeat_count\": " << repeat_count << "},\n  \"results\": [";
+        for (std::size_t r = 0; r < results.size(); ++r)
+        {
+            auto& result = results[r];
+            file << (r == 0 ? "" : ",") << "\n    {\"n\": " << result.n << ", \"add_sec\": " << result.addsec
+                 << ", \"cmds_sec\": " << result.cmdsec << ", \"total_sec\": " << result.totalsec;
+#ifdef USE_PERF_EVENT
+            for (std::size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+            {
+                file << ", \"add_" << PERF_COUNTER_NAMES[i] << "\": " << result.addcounts[i];
+            }
+            for (std::size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+            {
+                file << ", \"cmds_" << PERF_COUNTER_NAMES[i] << "\": " << result.cmdcounts[i];
+            }
+#endif
+            file << ", \"peak_rss_kb\": " << result.peakrss << ", \"bytes_per_affiliation\": " << result.affiliationbytes
+                 << ", \"bytes_per_publication\": " << result.publicationbytes << ", \"commands\": [";
+            bool first = true;
+            for (std::size_t i = 0; i < names.size(); ++i)
+            {
+                auto& histogram = result.latencies[i];
+                if (histogram.count() == 0) { continue; }
+                file << (first ? "" : ",") << "\n      {\"command\": " << json_string(names[i]) << ", \"calls\": " << histogram.count();
+                for (std::size_t p = 0; p < std::size(percentiles); ++p)
                 {
-                    result = (this->*(pos->func))(output, ++(match2.begin()), match2.end());
+                    file << ", \"" << percentilenames[p] << "_usec\": " << histogram.percentile(percentiles[p]) / 1000.0;
                 }
-                catch (NotImplemented const& e)
+                file << ", \"max_usec\": " << histogram.max() / 1000.0 << "}";
+                first = false;
+            }
+            file << "]}";
+        }
+        file << "\n  ]\n}\n";
+    }
+    else
+    {
+        // One row for each N and command, metadata in comment lines at the top
+        file << "# seed=" << random_seed_ << "\n# compiler=" << compiler << "\n# flags=" << flags
+             << "\n# git_revision=" << revision << "\n# threads=" << Scheduler::instance().thread_count() << "\n# timeout=" << timeout << "\n# repeat_count=" << repeat_count << "\n";
+        file << "n,command,add_sec,cmds_sec,total_sec,";
+#ifdef USE_PERF_EVENT
+        for (auto name : PERF_COUNTER_NAMES) { file << "add_" << name << ","; }
+        for (auto name : PERF_COUNTER_NAMES) { file << "cmds_" << name << ","; }
+#endif
+        file << "peak_rss_kb,bytes_per_affiliation,bytes_per_publication,calls,p50_usec,p90_usec,p99_usec,p99.9_usec,max_usec\n";
+        for (auto& result : results)
+        {
+            for (std::size_t i = 0; i < names.size(); ++i)
+            {
+                auto& histogram = result.latencies[i];
+                if (histogram.count() == 0) { continue; }
+                file << result.n << "," << names[i] << "," << result.addsec << "," << result.cmdsec << "," << result.totalsec << ",";
+#ifdef USE_PERF_EVENT
+                for (auto count : result.addcounts) { file << count << ","; }
+                for (auto count : result.cmdcounts) { file << count << ","; }
+#endif
+                file << result.peakrss << "," << result.affiliationbytes << "," << result.publicationbytes << "," << histogram.count();
+                for (double percentile : percentiles)
                 {
-                    output << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
-                    std::cerr << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+                    file << "," << histogram.percentile(percentile) / 1000.0;
                 }
+                file << "," << histogram.max() / 1000.0 << "\n";
+            }
+        }
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_concurrent(std::ostream& output, MatchIter begin, MatchIter end)
+{
+#ifdef _GLIBCXX_DEBUG
+    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
+#endif // _GLIBCXX_DEBUG
 
-                if (use_stopwatch)
+    try {
+    // Note: everything below is indented too little by one indentation level! (because of try block above)
+
+    string commandstr = *begin++;
+    unsigned int timeout = convert_string_to<unsigned int>(*begin++);
+    unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
+    string sizes = *begin++;
+    string threadcountstr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<string> testcmds;
+    smatch scmd;
+    auto cbeg = commandstr.cbegin();
+    auto cend = commandstr.cend();
+    for ( ; regex_search(cbeg, cend, scmd, commands_regex_); cbeg = scmd.suffix().first)
+    {
+        testcmds.push_back(scmd[1]);
+    }
+
+    vector<unsigned int> init_ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        init_ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    // By default thread counts double up to the number of cores
+    vector<unsigned int> threadcounts;
+    auto tbeg = threadcountstr.cbegin();
+    auto tend = threadcountstr.cend();
+    for ( ; regex_search(tbeg, tend, size, sizes_regex_); tbeg = size.suffix().first)
+    {
+        auto threads = convert_string_to<unsigned int>(size[1]);
+        if (threads > 0) { threadcounts.push_back(threads); }
+    }
+    if (threadcounts.empty())
+    {
+        unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int threads = 1; threads < cores; threads *= 2) { threadcounts.push_back(threads); }
+        threadcounts.push_back(cores);
+    }
+
+    output << "Timeout for each N is " << timeout << " sec. " << endl;
+    output << "For each N and thread count perform " << repeat_count << " random command(s) in total from:" << endl;
+
+    // Only queries can share the data structure, anything that changes it is left out
+    auto read_only = [](string const& name) {
+        return name.compare(0, 4, "get_") == 0 || name.compare(0, 6, "count_") == 0 || name.compare(0, 5, "find_") == 0 ||
+               (name.size() > 5 && name.compare(name.size() - 5, 5, "_info") == 0);
+    };
+    vector<void(MainProgram::*)()> testfuncs;
+    for (auto& i : testcmds)
+    {
+        auto pos = find_if(cmds_.begin(), cmds_.end(), [&i](auto const& cmd){ return cmd.cmd == i; });
+        if (pos != cmds_.end() && pos->testfunc && read_only(i))
+        {
+            output << i << " ";
+            testfuncs.push_back(pos->testfunc);
+        }
+        else
+        {
+            output << "(cannot test " << i << " concurrently) ";
+        }
+    }
+
+    output << endl << endl;
+
+    if (testfuncs.empty())
+    {
+        output << "No commands to test!" << endl;
+        return {};
+    }
+
+    output << setw(7) << "N" << " , " << setw(7) << "threads" << " , " << setw(12) << "cmds (sec)" << " , "
+           << setw(12) << "cmds/sec" << " , " << setw(8) << "speedup" << " , " << setw(10) << "efficiency" << endl;
+    flush_output(output);
+
+    auto stop = false;
+    for (unsigned int n : init_ns)
+    {
+        if (stop) { break; }
+
+        ds_.clear_all();
+        init_primes();
+
+        std::unordered_set<Coord,CoordHash> exclude_list;
+        std::vector<Coord> unique_coords = get_unique_coords(n,exclude_list,RANDOM_MIN_COORD,RANDOM_MAX_COORD);
+        for (unsigned int added = 0; added < n; added += 1000)
+        {
+            unsigned int count = std::min(1000u, n - added);
+            std::vector<Coord> vector_slice(unique_coords.begin() + added, unique_coords.begin() + added + count);
+            add_random_affiliations_publications(count,RANDOM_MIN_COORD,RANDOM_MAX_COORD,vector_slice);
+        }
+
+        double perthread = 0; // Commands per second of one thread, from the first thread count
+        for (unsigned int threads : threadcounts)
+        {
+            auto [seconds, commands] = run_concurrent_commands(testfuncs, threads, repeat_count, timeout);
+            if (commands < repeat_count)
+            {
+                output << setw(7) << n << " , " << setw(7) << threads << " , Timeout!" << endl;
+                stop = true;
+                break;
+            }
+
+            double rate = (seconds > 0) ? commands / seconds : 0;
+            if (perthread == 0) { perthread = rate / threads; }
+            double speedup = (perthread > 0) ? rate / perthread : 0;
+            output << setw(7) << n << " , " << setw(7) << threads << " , " << setw(12) << seconds << " , " << setw(12)
+                   << static_cast<unsigned long>(rate) << " , " << setw(8) << speedup << " , " << setw(10) << speedup / threads << endl;
+            flush_output(output);
+
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                stop = true;
+                break;
+            }
+        }
+    }
+
+    ds_.clear_all();
+    init_primes();
+
+    }
+    catch (NotImplemented const&)
+    {
+        // Clean up after NotImplemented
+        ds_.clear_all();
+        init_primes();
+        throw;
+    }
+
+    return {};
+}
+
+std::pair<double, unsigned long> MainProgram::run_concurrent_commands(vector<void(MainProgram::*)()> const& testfuncs, unsigned int threadcount,
+                                                                      unsigned int repeat_count, unsigned int timeout)
+{
+    // Every thread draws its commands from an engine of its own, seeded from the main one
+    vector<std::minstd_rand::result_type> seeds;
+    for (unsigned int i = 0; i < threadcount; ++i) { seeds.push_back(rand_engine_()); }
+
+    std::atomic<bool> timedout = false;
+    std::atomic<unsigned long> done = 0;
+    vector<std::exception_ptr> errors(threadcount);
+    auto start = std::chrono::steady_clock::now();
+
+    // The callers are threads of their own rather than scheduler tasks: they stand for
+    // independent clients, and the scheduler's workers stay free for the operations they call
+    vector<std::thread> threads;
+    for (unsigned int t = 0; t < threadcount; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            std::minstd_rand engine(seeds[t]);
+            thread_rand_engine_ = &engine;
+            unsigned int count = repeat_count / threadcount + (t < repeat_count % threadcount ? 1 : 0);
+            unsigned long executed = 0;
+            try
+            {
+                for (unsigned int repeat = 0; repeat < count; ++repeat)
                 {
-                    stopwatch.stop();
+                    auto cmdpos = random(testfuncs.begin(), testfuncs.end());
+                    (this->**cmdpos)();
+                    ++executed;
+
+                    if (repeat % 10 == 0)
+                    {
+                        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                        if (timedout || elapsed.count() >= timeout)
+                        {
+                            timedout = true;
+                            break;
+                        }
+                    }
                 }
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+            }
+            thread_rand_engine_ = nullptr;
+            done += executed;
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    for (auto& error : errors)
+    {
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), done};
+}
+
+MainProgram::CmdResult MainProgram::cmd_concurrency_test(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    unsigned int n = convert_string_to<unsigned int>(*begin++);
+    unsigned int publications = convert_string_to<unsigned int>(*begin++);
+    unsigned int readercount = std::max(1u, convert_string_to<unsigned int>(*begin++));
+    string publishstr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    unsigned int publishevery = publishstr.empty() ? 16 : std::max(1u, convert_string_to<unsigned int>(publishstr));
+
+    output << "Adding " << publications << " publications to " << n << " affiliations on one thread while "
+           << readercount << " thread(s) run get_shortest_path and get_publications_after, "
+           << publishevery << " mutations per version" << endl;
+    flush_output(output);
 
-                switch (result.first)
+    ds_.clear_all();
+    init_primes();
+
+    std::unordered_set<Coord,CoordHash> exclude_list;
+    std::vector<Coord> unique_coords = get_unique_coords(n,exclude_list,RANDOM_MIN_COORD,RANDOM_MAX_COORD);
+    for (unsigned int added = 0; added < n; added += 1000)
+    {
+        unsigned int count = std::min(1000u, n - added);
+        std::vector<Coord> vector_slice(unique_coords.begin() + added, unique_coords.begin() + added + count);
+        add_random_affiliations_publications(count,RANDOM_MIN_COORD,RANDOM_MAX_COORD,vector_slice);
+    }
+
+    // Every copy of the versioned data starts from a snapshot of the generated data
+    ostringstream snapshotdata;
+    ds_.save_snapshot(snapshotdata);
+    VersionedDatastructures versions(publishevery);
+    versions.write([data = snapshotdata.str()](Datastructures& ds) {
+        istringstream input(data);
+        return ds.load_snapshot(input);
+    });
+    versions.publish();
+
+    vector<std::minstd_rand::result_type> seeds;
+    for (unsigned int i = 0; i <= readercount; ++i) { seeds.push_back(rand_engine_()); }
+
+    // Every reader checks that its snapshot doesn't change under it and that the versions only move forward
+    struct ReaderResult
+    {
+        unsigned long queries = 0;
+        unsigned long snapshots = 0;
+        unsigned long inconsistencies = 0;
+    };
+    vector<ReaderResult> readerresults(readercount);
+    vector<std::exception_ptr> errors(readercount + 1);
+    std::atomic<bool> writing = true;
+    double writerseconds = 0;
+
+    vector<std::thread> threads;
+    threads.emplace_back([&]() {
+        std::minstd_rand engine(seeds[0]);
+        thread_rand_engine_ = &engine;
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            // New publications continue the numbering and the binary reference tree of the generated ones
+            for (unsigned long i = random_publications_added_; i < random_publications_added_ + publications; ++i)
+            {
+                PublicationID id = n_to_publicationid(i);
+                vector<AffiliationID> affiliations;
+                for (int j = 0; j < 4; ++j) { affiliations.push_back(random_affiliation()); }
+                Year year = get_random_year();
+                versions.write([id, year, affiliations](Datastructures& ds) {
+                    return ds.add_publication(id, convert_to_string(id), year, affiliations);
+                });
+                PublicationID parentid = n_to_publicationid(i / 2);
+                versions.write([id, parentid](Datastructures& ds) { return ds.add_reference(id, parentid); });
+            }
+            versions.publish();
+        }
+        catch (...)
+        {
+            errors[0] = std::current_exception();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        writerseconds = elapsed.count();
+        thread_rand_engine_ = nullptr;
+        writing = false;
+    });
+    for (unsigned int t = 0; t < readercount; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            std::minstd_rand engine(seeds[t + 1]);
+            thread_rand_engine_ = &engine;
+            ReaderResult& result = readerresults[t];
+            std::uint64_t lastversion = 0;
+            std::size_t lastcount = 0;
+            try
+            {
+                // One more round after the writer is done, so that the last version is read too
+                for (bool more = true; more; )
                 {
-                    case ResultType::NOTHING:
+                    more = writing;
+                    auto snapshot = versions.snapshot();
+                    std::size_t count = snapshot->data.all_publications().size();
+                    snapshot->data.get_shortest_path(random_affiliation(), random_affiliation());
+                    snapshot->data.get_publications_after(random_affiliation(), get_random_year());
+                    result.queries += 2;
+                    ++result.snapshots;
+                    if (snapshot->data.all_publications().size() != count || snapshot->version < lastversion ||
+                        count < lastcount)
                     {
-                        break;
+                        ++result.inconsistencies;
                     }
-                    case ResultType::IDLIST:
+                    lastversion = snapshot->version;
+                    lastcount = count;
+                }
+            }
+            catch (...)
+            {
+                errors[t + 1] = std::current_exception();
+            }
+            thread_rand_engine_ = nullptr;
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    for (auto& error : errors)
+    {
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    ReaderResult total;
+    for (auto const& result : readerresults)
+    {
+        total.queries += result.queries;
+        total.snapshots += result.snapshots;
+        total.inconsistencies += result.inconsistencies;
+    }
+    std::size_t finalcount = versions.snapshot()->data.all_publications().size();
+    bool complete = finalcount == n + publications;
+
+    output << "Writer: " << 2 * publications << " mutations in " << writerseconds << " sec, " << versions.version()
+           << " versions published, " << versions.copies_made() << " extra copies made for held snapshots, waited for readers "
+           << versions.writer_waits() << " time(s)" << endl;
+    output << "Readers: " << total.queries << " queries on " << total.snapshots << " snapshots" << endl;
+    output << "Final version has " << finalcount << " publications" << (complete ? "" : " (expected " + std::to_string(n + publications) + ")") << endl;
+    output << ((total.inconsistencies == 0 && complete) ? "Snapshots consistent" : "INCONSISTENT snapshots: " + std::to_string(total.inconsistencies)) << endl;
+
+    ds_.clear_all();
+    init_primes();
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
+{
+    return {};
+}
+
+
+bool MainProgram::command_parse_line(std::string_view line, ostream& output)
+{
+
+    if (line.empty()) { return true; }
+
+    // The parameters are views into line, or into fallbackparams if the regexes had to be used
+    CmdParams params;
+    std::size_t paramcount = 0;
+    CmdInfo* pos = nullptr;
+    string fallbackparams;
+
+    if (!parse_command(line, pos, params, paramcount))
+    {
+        // Lines the hand-written parser doesn't accept go through the regexes, which also tell what is wrong
+        string inputline(line);
+        smatch match;
+        bool matched = regex_match(inputline, match, cmds_regex_);
+        if (!matched)
+        {
+            output << "Unknown command!" << endl;
+            return true;
+        }
+
+        assert(match.size() == 3);
+        string cmd = match[1];
+        fallbackparams = match[2];
+
+        pos = &*find_if(cmds_.begin(), cmds_.end(), [cmd](CmdInfo const& ci) { return ci.cmd == cmd; });
+
+        smatch match2;
+        bool matched2 = regex_match(fallbackparams, match2, pos->param_regex);
+        if (!matched2)
+        {
+            output << "Invalid parameters for command '" << cmd << "'!" << endl;
+            return true;
+        }
+
+        assert(!match2.empty() && match2.size() <= params.size() + 1);
+        paramcount = 0;
+        for (auto submatch = ++match2.begin(); submatch != match2.end(); ++submatch)
+        {
+            params[paramcount++] = {std::string_view(fallbackparams).substr(submatch->first - fallbackparams.cbegin(), submatch->length())};
+        }
+    }
+
+    return execute_command(pos, params.data(), params.data() + paramcount, output);
+}
+
+bool MainProgram::parse_command(std::string_view line, CmdInfo*& pos, CmdParams& params, std::size_t& paramcount) const
+{
+    // Command name up to the first whitespace, then the parameters after the whitespace
+    pos = nullptr;
+    std::size_t namebegin = line.find_first_not_of(SPACE_CHARS);
+    if (namebegin != std::string_view::npos)
+    {
+        std::size_t nameend = std::min(line.find_first_of(SPACE_CHARS, namebegin), line.size());
+        std::size_t parambegin = std::min(line.find_first_not_of(SPACE_CHARS, nameend), line.size());
+        std::string_view paramtext = line.substr(parambegin);
+        if (paramtext.find_first_of("\n\r") == std::string_view::npos)
+        {
+            pos = find_command(line.substr(namebegin, nameend - namebegin));
+            if (pos && !(pos->param_shape && parse_params(paramtext, pos->param_shape, params, paramcount)))
+            {
+                pos = nullptr;
+            }
+        }
+    }
+    return pos != nullptr;
+}
+
+bool MainProgram::execute_command(CmdInfo* pos, MatchIter begin, MatchIter end, ostream& output)
+{
+    string const& cmd = pos->cmd;
+
+    if (pos->func)
+    {
+        bool use_stopwatch = (stopwatch_mode != StopwatchMode::OFF);
+        Stopwatch stopwatch(use_stopwatch); // Hardware counters only when the time is shown
+        // Reset stopwatch mode if only for the next command
+        if (stopwatch_mode == StopwatchMode::NEXT) { stopwatch_mode = StopwatchMode::OFF; }
+
+       TestStatus initial_status = test_status_;
+       test_status_ = TestStatus::NOT_RUN;
+
+        if (use_stopwatch)
+        {
+            stopwatch.start();
+        }
+
+        CmdResult result;
+        try
+        {
+            result = (this->*(pos->func))(output, begin, end);
+        }
+        catch (NotImplemented const& e)
+        {
+            output << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+            std::cerr << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+        }
+
+        if (use_stopwatch)
+        {
+            stopwatch.stop();
+        }
+
+        // The command's changes are in memory, but their log records didn't reach the file
+        if (ds_.take_wal_failure())
+        {
+            output << "Writing the write-ahead log failed, changes are not on disk yet!" << endl;
+        }
+
+        // A stream without a buffer discards everything (read ... fast), so results aren't formatted at all
+        switch (output.rdbuf() ? result.first : ResultType::NOTHING)
+        {
+            case ResultType::NOTHING:
+            {
+                break;
+            }
+            case ResultType::IDLIST:
+            {
+                auto& [publications, affiliations] = std::get<CmdResultIDs>(result.second);
+                if (affiliations.size() == 1 && affiliations.front() == NO_AFFILIATION)
+                {
+                    output << "Failed (NO_AFFILIATION returned)!" << std::endl;
+                }
+                else
+                {
+                    if (!affiliations.empty())
                     {
-                        auto& [publications, affiliations] = std::get<CmdResultIDs>(result.second);
-                        if (affiliations.size() == 1 && affiliations.front() == NO_AFFILIATION)
-                        {
-                            output << "Failed (NO_AFFILIATION returned)!" << std::endl;
-                        }
-                        else
-                        {
-                            if (!affiliations.empty())
-                            {
-                                if (affiliations.size() == 1) { output << "Affiliation:" << std::endl; }
-                                else { output << "Affiliations:" << std::endl; }
-
-                                unsigned int num = 0;
-                                for (AffiliationID& id : affiliations)
-                                {
-                                    ++num;
-                                    if (affiliations.size() > 1) { output << num << ". "; }
-                                    else { output << "   "; }
-                                    print_affiliation(id, output);
-                                }
-                            }
-                        }
+                        if (affiliations.size() == 1) { output << "Affiliation:" << std::endl; }
+                        else { output << "Affiliations:" << std::endl; }
 
-                        if (publications.size() == 1 && publications.front() == NO_PUBLICATION)
+                        unsigned int num = 0;
+                        for (AffiliationID& id : affiliations)
                         {
-                            output << "Failed (NO_PUBLICATION returned)!" << std::endl;
+                            ++num;
+                            if (affiliations.size() > 1) { output << num << ". "; }
+                            else { output << "   "; }
+                            print_affiliation(id, output);
                         }
-                        else
+                    }
+                }
+
+                if (publications.size() == 1 && publications.front() == NO_PUBLICATION)
+                {
+                    output << "Failed (NO_PUBLICATION returned)!" << std::endl;
+                }
+                else
+                {
+                    if (!publications.empty())
+                    {
+                        if (publications.size() == 1) { output << "Publication:" << std::endl; }
+                        else { output << "Publications:" << std::endl; }
+
+                        unsigned int num = 0;
+                        for (PublicationID id : publications)
                         {
-                            if (!publications.empty())
-                            {
-                                if (publications.size() == 1) { output << "Publication:" << std::endl; }
-                                else { output << "Publications:" << std::endl; }
-
-                                unsigned int num = 0;
-                                for (PublicationID id : publications)
-                                {
-                                    ++num;
-                                    if (publications.size() > 1) { output << num << ". "; }
-                                    else { output << "   "; }
-                                    print_publication(id, output);
-                                }
-                            }
+                            ++num;
+                            if (publications.size() > 1) { output << num << ". "; }
+                            else { output << "   "; }
+                            print_publication(id, output);
                         }
-                        break;
                     }
-                    case ResultType::ROUTE:
+                }
+                break;
+            }
+            case ResultType::ROUTE:
+            {
+                auto& route = std::get<CmdResultRoute>(result.second);
+                if (!route.empty())
+                {
+                    if (route.size() == 1 && get<0>(route.front()) == NO_AFFILIATION)
+                    {
+                        output << "Failed (...NO_AFFILIATION... returned)!" << std::endl;
+                    }
+                    else
                     {
-                        auto& route = std::get<CmdResultRoute>(result.second);
-                        if (!route.empty())
+                        unsigned int num = 1;
+                        for (auto& r : route)
                         {
-                            if (route.size() == 1 && get<0>(route.front()) == NO_AFFILIATION)
+                            auto [affiliationid1, weight, affiliationid2, dist] = r;
+                            output << num << ". ";
+                            if (affiliationid1 != NO_AFFILIATION)
                             {
-                                output << "Failed (...NO_AFFILIATION... returned)!" << std::endl;
+                                print_affiliation_brief(affiliationid1, output, false);
                             }
-                            else
+                            if (affiliationid2 != NO_AFFILIATION)
                             {
-                                unsigned int num = 1;
-                                for (auto& r : route)
-                                {
-                                    auto [affiliationid1, weight, affiliationid2, dist] = r;
-                                    output << num << ". ";
-                                    if (affiliationid1 != NO_AFFILIATION)
-                                    {
-                                        print_affiliation_brief(affiliationid1, output, false);
-                                    }
-                                    if (affiliationid2 != NO_AFFILIATION)
-                                    {
-                                        output << " -> ";
-                                        print_affiliation_brief(affiliationid2, output, false);
-                                    }
-                                    if (weight != NO_WEIGHT)
-                                    {
-                                        output << " (weighted " << weight << ")";
-                                    }
-                                    if (dist != NO_DISTANCE)
-                                    {
-                                        output << " (distance " << dist << ")";
-                                    }
-                                    output << endl;
-
-                                    ++num;
-                                }
+                                output << " -> ";
+                                print_affiliation_brief(affiliationid2, output, false);
                             }
-                        }
-                        break;
-                    }
-                    case ResultType::CONNECTIONLIST:{
-                        auto& list = std::get<ConnectionList>(result.second);
-                        unsigned int num = 1;
+                            if (weight != NO_WEIGHT)
+                            {
+                                output << " (weighted " << weight << ")";
+                            }
+                            if (dist != NO_DISTANCE)
+                            {
+                                output << " (distance " << dist << ")";
+                            }
+                            output << endl;
 
-                        std::for_each(list.begin(),list.end(),[&output,&num,this](auto& connection){
-                            output << num++ << ". ";
-                            print_affiliation_brief(connection.aff1 ,output,false);
-                            output << " -> ";
-                            print_affiliation_brief(connection.aff2, output, false);
-                            output <<" (weighted "<<connection.weight<<")"<<endl;
-                        });
-                        break;
-                    }
-                    case ResultType::NEIGHBOURLIST:{
-                        auto& list = std::get<ConnectionList>(result.second);
-                        auto source_id = list.front().aff1;
-                        output << "All connected affiliations from ";
-                        print_affiliation_brief(source_id,output,false);
-                        output << endl;
-                        unsigned int num = 1;
-                        std::for_each(list.begin(),list.end(),[&output,&num,this](auto& connection){
-                            output << num++ << ". ";
-                            print_affiliation_brief(connection.aff2, output, false);
-                            output <<" (weighted "<<connection.weight<<")"<<endl;
-                        });
-                        break;
-                    }
-                    default:
-                    {
-                        assert(false && "Unsupported result type!");
+                            ++num;
+                        }
                     }
                 }
+                break;
+            }
+            case ResultType::CONNECTIONLIST:{
+                auto& list = std::get<ConnectionList>(result.second);
+                unsigned int num = 1;
+
+                std::for_each(list.begin(),list.end(),[&output,&num,this](auto& connection){
+                    output << num++ << ". ";
+                    print_affiliation_brief(connection.aff1 ,output,false);
+                    output << " -> ";
+                    print_affiliation_brief(connection.aff2, output, false);
+                    output <<" (weighted "<<connection.weight<<")"<<endl;
+                });
+                break;
+            }
+            case ResultType::NEIGHBOURLIST:{
+                auto& list = std::get<ConnectionList>(result.second);
+                auto source_id = list.front().aff1;
+                output << "All connected affiliations from ";
+                print_affiliation_brief(source_id,output,false);
+                output << endl;
+                unsigned int num = 1;
+                std::for_each(list.begin(),list.end(),[&output,&num,this](auto& connection){
+                    output << num++ << ". ";
+                    print_affiliation_brief(connection.aff2, output, false);
+                    output <<" (weighted "<<connection.weight<<")"<<endl;
+                });
+                break;
+            }
+            default:
+            {
+                assert(false && "Unsupported result type!");
+            }
+        }
 
-                if (result != prev_result)
-                {
-                    prev_result = move(result);
-                    view_dirty = true;
-                }
+        if (result != prev_result)
+        {
+            prev_result = move(result);
+            view_dirty = true;
+        }
 
-                if (use_stopwatch)
-                {
-                    output << "Command '" << cmd << "': " << stopwatch.elapsed() << " sec";
+        if (use_stopwatch)
+        {
+            output << "Command '" << cmd << "': " << stopwatch.elapsed() << " sec";
 #ifdef USE_PERF_EVENT
-                    auto totalcount = stopwatch.count();
-                    output << ", cmds (count): " << totalcount;
+            output << ", ";
+            print_perf_counts(output, stopwatch.counts());
 #endif
-                    output << endl;
-                }
+            output << endl;
+        }
 
-                if (test_status_ != TestStatus::NOT_RUN)
-                {
-                    output << "Testread-tests have been run, " << ((test_status_ == TestStatus::DIFFS_FOUND) ? "differences found!" : "no differences found.") << endl;
-                }
-                if (test_status_ == TestStatus::NOT_RUN || (test_status_ == TestStatus::NO_DIFFS && initial_status == TestStatus::DIFFS_FOUND))
-                {
-                    test_status_ = initial_status;
-                }
-            }
-            else
-            { // No function to run = quit command
-                return false;
-            }
+        if (test_status_ != TestStatus::NOT_RUN)
+        {
+            output << "Testread-tests have been run, " << ((test_status_ == TestStatus::DIFFS_FOUND) ? "differences found!" : "no differences found.") << endl;
         }
-        else
+        if (test_status_ == TestStatus::NOT_RUN || (test_status_ == TestStatus::NO_DIFFS && initial_status == TestStatus::DIFFS_FOUND))
         {
-            output << "Invalid parameters for command '" << cmd << "'!" << endl;
+            test_status_ = initial_status;
         }
     }
     else
-    {
-        output << "Unknown command!" << endl;
+    { // No function to run = quit command
+        return false;
     }
 
     return true; // Signal continuing
@@ -1887,6 +3415,298 @@ void MainProgram::command_parser(istream& input, ostream& output, PromptStyle pr
     view_dirty = true; // To be safe, assume that results have been changed
 }
 
+// Splits a command file into lines, reading it in large chunks of whole lines. In
+// parallel mode the chunks ahead are parsed on the other threads of the scheduler
+// while the commands of the current chunk are executed.
+class MainProgram::CommandFileReader
+{
+public:
+    CommandFileReader(MainProgram& program, istream& input, bool parallel)
+        : program_(program), input_(input), parallel_(parallel)
+    {
+        program_.file_readers_.push_back(this);
+    }
+
+    // The chunks still being parsed refer to the reader
+    ~CommandFileReader()
+    {
+        wait_parsed();
+        auto& readers = program_.file_readers_;
+        readers.erase(std::find(readers.begin(), readers.end(), this));
+    }
+
+    // Returns once the chunks queued ahead are parsed, they stay queued
+    void wait_parsed() const
+    {
+        for (auto& chunk : ahead_) { chunk.wait(); }
+    }
+
+    // The line is a view into the current chunk, valid until the next call. lastline
+    // tells that the input ended without a newline after the line, as getline would.
+    // parsed is the line parsed ahead, nullptr if it hasn't been parsed.
+    bool next(std::string_view& line, bool& lastline, ParsedLine const*& parsed);
+
+    MatchIter params(ParsedLine const& parsed) const { return current_.params.data() + parsed.firstparam; }
+
+private:
+    struct Chunk
+    {
+        vector<char> data;
+        vector<ParsedLine> lines;
+        vector<CmdParam> params;
+        bool parsed = false;
+    };
+
+    static std::size_t const CHUNK_SIZE = 1 << 20;
+    bool next_chunk();
+    Chunk read_chunk();
+    void parse_chunk(Chunk& chunk) const;
+
+    MainProgram& program_;
+    istream& input_;
+    bool parallel_;
+    bool eof_ = false;
+    vector<char> carry_; // Start of a line that continues in the next chunk
+    std::deque<std::future<Chunk>> ahead_;
+    Chunk current_;
+    std::size_t pos_ = 0; // Next line of current_ if it is parsed, next byte otherwise
+};
+
+void MainProgram::wait_file_parsing() const
+{
+    for (CommandFileReader* reader : file_readers_) { reader->wait_parsed(); }
+}
+
+bool MainProgram::CommandFileReader::next(std::string_view& line, bool& lastline, ParsedLine const*& parsed)
+{
+    while (current_.parsed ? pos_ == current_.lines.size() : pos_ == current_.data.size())
+    {
+        if (!next_chunk())
+        {
+            line = {};
+            return false;
+        }
+    }
+
+    char const* data = current_.data.data();
+    if (current_.parsed)
+    {
+        parsed = &current_.lines[pos_++];
+        line = parsed->line;
+    }
+    else
+    {
+        auto newline = static_cast<char const*>(std::memchr(data + pos_, '\n', current_.data.size() - pos_));
+        std::size_t end = newline ? newline - data : current_.data.size();
+        parsed = nullptr;
+        line = std::string_view(data + pos_, end - pos_);
+        pos_ = std::min(end + 1, current_.data.size());
+    }
+    lastline = (line.data() + line.size() == data + current_.data.size());
+    return true;
+}
+
+bool MainProgram::CommandFileReader::next_chunk()
+{
+    if (!parallel_)
+    {
+        current_ = read_chunk();
+    }
+    else
+    {
+        // Keep a chunk per thread being parsed ahead of the one being executed. The thread
+        // count is looked up each time, as set_threads in the file may have changed it.
+        Scheduler& scheduler = Scheduler::instance();
+        std::size_t threads = std::max(2u, scheduler.thread_count()) - 1;
+        while (ahead_.size() < threads && !(eof_ && carry_.empty()))
+        {
+            ahead_.push_back(scheduler.async([this, chunk = read_chunk()]() mutable { parse_chunk(chunk); return std::move(chunk); }));
+        }
+        if (ahead_.empty()) { return false; }
+        current_ = ahead_.front().get();
+        ahead_.pop_front();
+    }
+    pos_ = 0;
+    return !current_.data.empty();
+}
+
+MainProgram::CommandFileReader::Chunk MainProgram::CommandFileReader::read_chunk()
+{
+    Chunk chunk;
+    chunk.data.swap(carry_);
+    while (!eof_)
+    {
+        std::size_t size = chunk.data.size();
+        chunk.data.resize(size + CHUNK_SIZE);
+        input_.read(chunk.data.data() + size, CHUNK_SIZE);
+        chunk.data.resize(size + input_.gcount());
+        eof_ = !input_;
+
+        // Whole lines stay in this chunk, the rest is carried over to the next one
+        auto newline = std::find(chunk.data.rbegin(), chunk.data.rend() - size, '\n');
+        if (newline != chunk.data.rend() - size)
+        {
+            carry_.assign(newline.base(), chunk.data.end());
+            chunk.data.erase(newline.base(), chunk.data.end());
+            break;
+        }
+    }
+    return chunk;
+}
+
+void MainProgram::CommandFileReader::parse_chunk(Chunk& chunk) const
+{
+    chunk.parsed = true;
+    char const* data = chunk.data.data();
+    CmdParams params;
+    for (std::size_t begin = 0; begin < chunk.data.size(); )
+    {
+        auto newline = static_cast<char const*>(std::memchr(data + begin, '\n', chunk.data.size() - begin));
+        std::size_t end = newline ? newline - data : chunk.data.size();
+
+        ParsedLine parsed;
+        parsed.line = std::string_view(data + begin, end - begin);
+        std::size_t paramcount = 0;
+        if (!parsed.line.empty() && program_.parse_command(parsed.line, parsed.cmd, params, paramcount))
+        {
+            parsed.firstparam = chunk.params.size();
+            parsed.paramcount = paramcount;
+            chunk.params.insert(chunk.params.end(), params.begin(), params.begin() + paramcount);
+        }
+        chunk.lines.push_back(parsed);
+        begin = end + 1;
+    }
+}
+
+void MainProgram::file_command_parser(istream& input, ostream& output, PromptStyle promptstyle, bool parallel)
+{
+    // Lines are split in place in the chunk buffer and output is collected into a batch,
+    // which is written out whenever it grows large (endl doesn't flush a string stream)
+    std::size_t const BATCH_SIZE = 1 << 16;
+
+    // The GUI sorts cmds_ after start-up, so the name index is brought up to date first
+    if (std::any_of(cmd_index_.begin(), cmd_index_.end(), [](auto const& entry) { return cmds_[entry.second].cmd != entry.first; }))
+    {
+        build_cmd_index();
+    }
+
+    // In parallel mode the other threads only parse, the commands are executed here one at a time
+    CommandFileReader reader(*this, input, parallel);
+    ostringstream batch;
+    ostream& out = output.rdbuf() ? batch : output;
+    auto write_batch = [&output, &batch]() {
+        output << batch.str() << flush;
+        batch.str("");
+    };
+
+    // Whatever the commands printed before one of them throws is written out before the error goes on
+    try
+    {
+        std::string_view line;
+        bool lastline = false;
+        while (true)
+        {
+            // Same prompts and echoes as command_parser gives with getline, which leaves
+            // the previous line in place once the input has ended without a newline
+            ParsedLine const* parsed = nullptr;
+            bool gotline = !lastline && reader.next(line, lastline, parsed);
+            if (promptstyle != PromptStyle::NO_PROMPT)
+            {
+                out << PROMPT;
+                if (promptstyle != PromptStyle::NO_ECHO)
+                {
+                    out << line << '\n';
+                }
+            }
+
+            if (!gotline) { break; }
+
+            bool cont = (parsed && parsed->cmd)
+                ? execute_command(parsed->cmd, reader.params(*parsed), reader.params(*parsed) + parsed->paramcount, out)
+                : command_parse_line(line, out);
+            view_dirty = false; // No need to keep track of individual result changes
+            if (!cont) { break; }
+
+            if (&out == &batch && static_cast<std::size_t>(batch.tellp()) >= BATCH_SIZE) { write_batch(); }
+        }
+    }
+    catch (...)
+    {
+        if (&out == &batch) { write_batch(); }
+        throw;
+    }
+    if (&out == &batch) { write_batch(); }
+
+    view_dirty = true; // To be safe, assume that results have been changed
+}
+
+void MainProgram::import_csv_file(std::ostream& output, string const& filename, char const* what, std::string_view header,
+                                  function<bool(std::string_view const* fields, std::size_t count)> const& addrecord)
+{
+    ifstream input(filename);
+    if (!input)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return;
+    }
+
+    unsigned long const PROGRESS_INTERVAL = 1000000;
+    Stopwatch stopwatch;
+    stopwatch.start();
+
+    // Lines come straight from the file reader, without going through the command interpreter
+    CommandFileReader reader(*this, input, false);
+    std::string_view line;
+    bool lastline = false;
+    ParsedLine const* parsed = nullptr;
+    unsigned long linenumber = 0;
+    unsigned long added = 0;
+    unsigned long rejected = 0;
+    unsigned long firstrejected = 0;
+    bool firstrecord = true;
+    std::array<std::string, 4> fields;
+    std::array<std::string_view, 4> views;
+    while (reader.next(line, lastline, parsed))
+    {
+        ++linenumber;
+        if (linenumber % PROGRESS_INTERVAL == 0)
+        {
+            output << "..." << linenumber << " lines from '" << filename << "'" << endl;
+            flush_output(output);
+        }
+
+        // Empty lines, comments and a header naming the columns are skipped
+        std::string_view content = trim_csv_field(line);
+        if (content.empty() || content.front() == '#') { continue; }
+        std::size_t count = 0;
+        bool split = split_csv_line(line, fields, count);
+        if (firstrecord && split && count <= fields.size() && is_csv_header(fields.data(), count, header))
+        {
+            firstrecord = false;
+            continue;
+        }
+        firstrecord = false;
+
+        for (std::size_t i = 0; i < std::min(count, fields.size()); ++i) { views[i] = fields[i]; }
+        if (split && count <= fields.size() && addrecord(views.data(), count))
+        {
+            ++added;
+        }
+        else
+        {
+            if (rejected++ == 0) { firstrejected = linenumber; }
+        }
+    }
+    stopwatch.stop();
+
+    double seconds = stopwatch.elapsed();
+    output << what << " from '" << filename << "': " << added << " added, " << rejected << " rejected";
+    if (rejected != 0) { output << " (first on line " << firstrejected << ")"; }
+    output << ", " << linenumber << " lines in " << seconds << " sec";
+    if (seconds > 0) { output << " (" << static_cast<unsigned long>(linenumber / seconds) << " lines/sec)"; }
+    output << endl;
+}
+
 void MainProgram::setui(MainWindow* ui)
 {
     ui_ = ui;
@@ -1927,7 +3747,8 @@ std::array<unsigned long int, 20> const MainProgram::primes2{81031,  81041,  810
 
 MainProgram::MainProgram()
 {
-    rand_engine_.seed(time(nullptr));
+    random_seed_ = time(nullptr);
+    rand_engine_.seed(random_seed_);
 
     init_primes();
     init_regexs();
@@ -1951,7 +3772,7 @@ int MainProgram::mainprogram(int argc, char* argv[])
         ifstream input(filename);
         if (input)
         {
-            mainprg.command_parser(input, cout, MainProgram::PromptStyle::NORMAL);
+            mainprg.file_command_parser(input, cout, MainProgram::PromptStyle::NORMAL, false);
         }
         else
         {
@@ -2018,8 +3839,112 @@ Coord MainProgram::n_to_coord(unsigned long n)
     return {static_cast<int>(hash % 1000), static_cast<int>((hash/1000) % 1000)};
 }
 
+void MainProgram::build_cmd_index()
+{
+    // The names are copied so that the keys stay valid however cmds_ is reordered
+    std::size_t size = 0;
+    for (auto const& cmd : cmds_) { size += cmd.cmd.size(); }
+    cmd_names_.clear();
+    cmd_names_.reserve(size);
+    cmd_index_.clear();
+    for (std::size_t i = 0; i < cmds_.size(); ++i)
+    {
+        std::size_t offset = cmd_names_.size();
+        cmd_names_ += cmds_[i].cmd;
+        cmd_index_.emplace(std::string_view(cmd_names_).substr(offset, cmds_[i].cmd.size()), i);
+    }
+}
+
+MainProgram::CmdInfo* MainProgram::find_command(std::string_view name) const
+{
+    // If cmds_ has been reordered without rebuilding the index, the line is left to the regexes
+    auto it = cmd_index_.find(name);
+    if (it == cmd_index_.end() || cmds_[it->second].cmd != name) { return nullptr; }
+    return &cmds_[it->second];
+}
+
+bool MainProgram::parse_params(std::string_view text, char const* shape, CmdParams& params, std::size_t& count)
+{
+    // Matches exactly what the parameter regex with the same shape matches. All the
+    // parts end where the next one can't begin, so no backtracking is needed.
+    std::size_t pos = 0;
+    count = 0;
+    auto capture = [&params, &count](std::string_view part, bool allowempty) {
+        if ((part.empty() && !allowempty) || count == params.size()) { return false; }
+        params[count++] = {part};
+        return true;
+    };
+    auto capture_number = [&](){ return capture(take_while(text, pos, is_digit), false); };
+
+    for ( ; *shape; ++shape)
+    {
+        bool ok = true;
+        switch (*shape)
+        {
+            case ' ':
+                ok = !take_while(text, pos, is_space).empty();
+                break;
+            case 'a':
+                ok = capture(take_while(text, pos, is_id_char), false);
+                break;
+            case 'n':
+                ok = capture_number();
+                break;
+            case 'q':
+                ok = take_char(text, pos, '"') && capture(take_while(text, pos, is_name_char), false) && take_char(text, pos, '"');
+                break;
+            case 'c':
+                ok = take_char(text, pos, '(') && (take_while(text, pos, is_space), capture_number()) &&
+                     (take_while(text, pos, is_space), take_char(text, pos, ',')) &&
+                     (take_while(text, pos, is_space), capture_number()) &&
+                     (take_while(text, pos, is_space), take_char(text, pos, ')'));
+                break;
+            case 'l':
+            {
+                // Whitespace separated IDs, captured as one string including the leading whitespace
+                std::size_t begin = pos;
+                for (std::size_t next = pos; !take_while(text, next, is_space).empty() && !take_while(text, next, is_id_char).empty(); )
+                {
+                    pos = next;
+                }
+                ok = capture(text.substr(begin, pos - begin), true);
+                break;
+            }
+            case '*':
+                ok = capture(text.substr(pos), true);
+                pos = text.size();
+                break;
+            default:
+                assert(!"Impossible parameter shape!");
+        }
+        if (!ok) { return false; }
+    }
+
+    take_while(text, pos, is_space);
+    return pos == text.size();
+}
+
 void MainProgram::init_regexs()
 {
+    // Parameter regexes parse_params can match by hand. In a shape 'a' is an affiliation ID,
+    // 'n' a number, 'q' a quoted name, 'c' a coordinate, 'l' a list of affiliation IDs,
+    // '*' the rest of the line and ' ' whitespace.
+    vector<pair<string, char const*>> const shapes = {
+        {"", ""},
+        {".*", "*"},
+        {affiliationidx, "a"},
+        {numx, "n"},
+        {coordx, "c"},
+        {affiliationidx+wsx+affiliationidx, "a a"},
+        {affiliationidx+wsx+numx, "a n"},
+        {affiliationidx+wsx+coordx, "a c"},
+        {numx+wsx+numx, "n n"},
+        {affiliationidx+wsx+'"'+namex+'"'+wsx+coordx, "a q c"},
+        {publicationidx+wsx+'"'+namex+'"'+wsx+timex+"((?:"+wsx+affiliationlistx+")*)", "n q nl"},
+        {affiliationidx+"((?:"+wsx+affiliationlistx+")*)", "al"},
+        {affiliationidx+wsx+affiliationidx+"((?:"+wsx+affiliationlistx+")*)", "a al"},
+    };
+
     // Create regex <whitespace>(cmd1|cmd2|...)<whitespace>(.*)
     string cmds_regex_str = "[[:space:]]*(";
     bool first = true;
@@ -2029,11 +3954,15 @@ void MainProgram::init_regexs()
         first = false;
 
         cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        assert(cmd.param_regex.mark_count() <= MAX_CMD_PARAMS && "Too many parameters!");
+
+        auto shape = find_if(shapes.begin(), shapes.end(), [&cmd](auto const& s) { return s.first == cmd.param_regex_str; });
+        cmd.param_shape = (shape != shapes.end()) ? shape->second : nullptr;
     }
+    build_cmd_index();
     cmds_regex_str += ")(?:[[:space:]]*$|"+wsx+"(.*))";
     cmds_regex_ = regex(cmds_regex_str, std::regex_constants::ECMAScript | std::regex_constants::optimize);
     coords_regex_ = regex(coordx+"[[:space:]]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    affil_regex_ = regex(affiliationidx+"[[:space:]]?", std::regex_constants::ECMAScript | std::regex_constants::optimize); // TODO test this one more intensively
     times_regex_ = regex(wsx+"([0-9][0-9]):([0-9][0-9]):([0-9][0-9])", std::regex_constants::ECMAScript | std::regex_constants::optimize);
     commands_regex_ = regex("([0-9a-zA-Z_]+);?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
     sizes_regex_ = regex(numx+";?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
@@ -0,0 +1,798 @@
+// MappedImage.cc
+
+#include "mappedimage.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <queue>
+#include <stack>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDIMAGE_MMAP
+#endif
+
+namespace image
+{
+StringRef Builder::addString(const std::string& text)
+{
+    StringRef ref{strings.size(), text.size()};
+    strings.append(text);
+    return ref;
+}
+
+bool Builder::write(std::ostream& output) const
+{
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.affiliationCount = affiliationCount;
+
+    // Sections follow the header in order, each one aligned to 8 bytes
+    std::uint64_t offset = sizeof(Header);
+    auto place = [&](SectionIndex index, std::size_t count, std::size_t itemSize) {
+        offset = (offset + 7) & ~std::uint64_t(7);
+        header.sections[index] = {offset, count};
+        offset += count * itemSize;
+    };
+    place(STRINGS, strings.size(), 1);
+    place(NODES, nodes.size(), sizeof(Node));
+    place(PUBLICATIONS, publications.size(), sizeof(Publication));
+    place(NODE_PUBLICATIONS, nodePublications.size(), sizeof(std::uint32_t));
+    place(PUBLICATION_NODES, publicationNodes.size(), sizeof(std::uint32_t));
+    place(PUBLICATION_REFERENCES, publicationReferences.size(), sizeof(std::uint32_t));
+    place(PREORDER, preorder.size(), sizeof(std::uint32_t));
+    place(EDGES, edges.size(), sizeof(Edge));
+    place(NAME_ORDER, nameOrder.size(), sizeof(std::uint32_t));
+    place(DISTANCE_ORDER, distanceOrder.size(), sizeof(std::uint32_t));
+    place(COORD_INDEX, coordIndex.size(), sizeof(CoordEntry));
+    place(CITATION_ORDER, citationOrder.size(), sizeof(std::uint32_t));
+
+    std::uint64_t written = 0;
+    auto put = [&](SectionIndex index, const void* data, std::size_t bytes) {
+        static char const padding[8] = {};
+        output.write(padding, header.sections[index].offset - written);
+        output.write(static_cast<const char*>(data), bytes);
+        written = header.sections[index].offset + bytes;
+    };
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    written = sizeof(header);
+    put(STRINGS, strings.data(), strings.size());
+    put(NODES, nodes.data(), nodes.size() * sizeof(Node));
+    put(PUBLICATIONS, publications.data(), publications.size() * sizeof(Publication));
+    put(NODE_PUBLICATIONS, nodePublications.data(), nodePublications.size() * sizeof(std::uint32_t));
+    put(PUBLICATION_NODES, publicationNodes.data(), publicationNodes.size() * sizeof(std::uint32_t));
+    put(PUBLICATION_REFERENCES, publicationReferences.data(), publicationReferences.size() * sizeof(std::uint32_t));
+    put(PREORDER, preorder.data(), preorder.size() * sizeof(std::uint32_t));
+    put(EDGES, edges.data(), edges.size() * sizeof(Edge));
+    put(NAME_ORDER, nameOrder.data(), nameOrder.size() * sizeof(std::uint32_t));
+    put(DISTANCE_ORDER, distanceOrder.data(), distanceOrder.size() * sizeof(std::uint32_t));
+    put(COORD_INDEX, coordIndex.data(), coordIndex.size() * sizeof(CoordEntry));
+    put(CITATION_ORDER, citationOrder.data(), citationOrder.size() * sizeof(std::uint32_t));
+
+    return static_cast<bool>(output);
+}
+}
+
+std::unique_ptr<MappedImage> MappedImage::open(const std::string& filename)
+{
+    std::unique_ptr<MappedImage> result(new MappedImage());
+
+#ifdef MAPPEDIMAGE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(image::Header))) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // A shared read-only mapping lets every process use the same page cache pages.
+    // The mapping stays valid after the descriptor is closed.
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    result->mapped_ = true;
+    if (!result->attach(static_cast<const char*>(data), info.st_size)) {
+        return nullptr; // The destructor unmaps
+    }
+#else
+    std::ifstream file(filename, std::ios::binary);
+    result->buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (!file.eof() || !result->attach(result->buffer_.data(), result->buffer_.size())) {
+        return nullptr;
+    }
+#endif
+
+    return result;
+}
+
+MappedImage::~MappedImage()
+{
+#ifdef MAPPEDIMAGE_MMAP
+    if (mapped_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+bool MappedImage::attach(const char* data, std::size_t size)
+{
+    data_ = data;
+    size_ = size;
+    if (size < sizeof(image::Header)) {
+        return false;
+    }
+
+    header_ = reinterpret_cast<const image::Header*>(data);
+    if (std::memcmp(header_->magic, image::MAGIC, sizeof(image::MAGIC)) != 0 ||
+        header_->version != image::VERSION || header_->byteOrder != image::BYTE_ORDER_MARK) {
+        return false;
+    }
+
+    return section(image::STRINGS, strings_, stringCount_) &&
+           section(image::NODES, nodes_, nodeCount_) &&
+           section(image::PUBLICATIONS, publications_, publicationCount_) &&
+           section(image::NODE_PUBLICATIONS, nodePublications_, nodePublicationCount_) &&
+           section(image::PUBLICATION_NODES, publicationNodes_, publicationNodeCount_) &&
+           section(image::PUBLICATION_REFERENCES, publicationReferences_, publicationReferenceCount_) &&
+           section(image::PREORDER, preorder_, preorderCount_) &&
+           section(image::EDGES, edges_, edgeCount_) &&
+           section(image::NAME_ORDER, nameOrder_, nameOrderCount_) &&
+           section(image::DISTANCE_ORDER, distanceOrder_, distanceOrderCount_) &&
+           section(image::COORD_INDEX, coordIndex_, coordIndexCount_) &&
+           section(image::CITATION_ORDER, citationOrder_, citationOrderCount_) &&
+           validate();
+}
+
+bool MappedImage::validate() const
+{
+    // Every offset, range and index the queries follow is checked once here, so that a
+    // damaged file is rejected instead of being read outside the mapping
+    auto validText = [this](image::StringRef ref) {
+        return ref.length <= stringCount_ && ref.offset <= stringCount_ - ref.length;
+    };
+    auto validRange = [](std::uint64_t begin, std::uint64_t count, std::size_t size) {
+        return count <= size && begin <= size - count;
+    };
+    auto validIndices = [](const std::uint32_t* items, std::size_t count, std::size_t size) {
+        return std::all_of(items, items + count, [size](std::uint32_t item) { return item < size; });
+    };
+
+    std::uint64_t affiliations = 0;
+    for (std::size_t node = 0; node < nodeCount_; ++node) {
+        const image::Node& record = nodes_[node];
+        if (!validText(record.id) || !validText(record.name) ||
+            !validRange(record.publicationBegin, record.publicationCount, nodePublicationCount_) ||
+            !validRange(record.edgeBegin, record.edgeCount, edgeCount_)) {
+            return false;
+        }
+        affiliations += record.exists ? 1 : 0;
+    }
+    if (affiliations != header_->affiliationCount) {
+        return false;
+    }
+
+    // Depths grow by one from parent to child, which rules out cycles in the walks up the
+    // forest, and every jump is the one Datastructures::linkJump would pick, so jumps lead to
+    // ancestors and publications at the same depth jump to the same depth
+    for (std::size_t publication = 0; publication < publicationCount_; ++publication) {
+        const image::Publication& record = publications_[publication];
+        if (!validText(record.title) ||
+            !validRange(record.affiliationBegin, record.affiliationCount, publicationNodeCount_) ||
+            !validRange(record.referenceBegin, record.referenceCount, publicationReferenceCount_) ||
+            record.size == 0 || !validRange(record.preorder, record.size, preorderCount_)) {
+            return false;
+        }
+        if (record.parent == image::NONE) {
+            if (record.depth != 0 || record.jump != publication) {
+                return false;
+            }
+            continue;
+        }
+        if (record.parent >= publicationCount_) {
+            return false;
+        }
+        const image::Publication& parent = publications_[record.parent];
+        if (std::uint64_t(parent.depth) + 1 != record.depth || parent.jump >= publicationCount_ ||
+            publications_[parent.jump].jump >= publicationCount_) {
+            return false;
+        }
+        const image::Publication& jump = publications_[parent.jump];
+        const image::Publication& jump2 = publications_[jump.jump];
+        bool skip = parent.depth - jump.depth == jump.depth - jump2.depth;
+        if (record.jump != (skip ? jump.jump : record.parent)) {
+            return false;
+        }
+    }
+
+    return validIndices(nodePublications_, nodePublicationCount_, publicationCount_) &&
+           validIndices(publicationNodes_, publicationNodeCount_, nodeCount_) &&
+           validIndices(publicationReferences_, publicationReferenceCount_, publicationCount_) &&
+           validIndices(preorder_, preorderCount_, publicationCount_) &&
+           validIndices(nameOrder_, nameOrderCount_, nodeCount_) &&
+           validIndices(distanceOrder_, distanceOrderCount_, nodeCount_) &&
+           validIndices(citationOrder_, citationOrderCount_, publicationCount_) &&
+           std::all_of(edges_, edges_ + edgeCount_, [this](const image::Edge& edge) { return edge.node < nodeCount_; }) &&
+           std::all_of(coordIndex_, coordIndex_ + coordIndexCount_,
+                       [this](const image::CoordEntry& entry) { return entry.node < nodeCount_; });
+}
+
+template <typename Type>
+bool MappedImage::section(image::SectionIndex index, const Type*& items, std::size_t& count) const
+{
+    const image::Section& section = header_->sections[index];
+    if (section.offset % alignof(Type) != 0 || section.offset > size_ ||
+        section.count > (size_ - section.offset) / sizeof(Type)) {
+        return false;
+    }
+    items = reinterpret_cast<const Type*>(data_ + section.offset);
+    count = section.count;
+    return true;
+}
+
+std::string_view MappedImage::text(image::StringRef ref) const
+{
+    return std::string_view(strings_ + ref.offset, ref.length);
+}
+
+AffiliationID MappedImage::nodeID(std::uint32_t node) const
+{
+    return AffiliationID(text(nodes_[node].id));
+}
+
+std::uint32_t MappedImage::findNode(const AffiliationID& id) const
+{
+    auto it = std::lower_bound(nodes_, nodes_ + nodeCount_, id,
+                               [this](const image::Node& node, const AffiliationID& key) { return text(node.id) < key; });
+    if (it == nodes_ + nodeCount_ || text(it->id) != id) {
+        return image::NONE;
+    }
+    return it - nodes_;
+}
+
+std::uint32_t MappedImage::findAffiliation(const AffiliationID& id) const
+{
+    std::uint32_t node = findNode(id);
+    return (node != image::NONE && nodes_[node].exists) ? node : image::NONE;
+}
+
+std::uint32_t MappedImage::findPublication(PublicationID id) const
+{
+    auto it = std::lower_bound(publications_, publications_ + publicationCount_, id,
+                               [](const image::Publication& publication, PublicationID key) { return publication.id < key; });
+    if (it == publications_ + publicationCount_ || it->id != id) {
+        return image::NONE;
+    }
+    return it - publications_;
+}
+
+unsigned int MappedImage::get_affiliation_count() const
+{
+    return header_->affiliationCount;
+}
+
+std::vector<AffiliationID> MappedImage::get_all_affiliations() const
+{
+    std::vector<AffiliationID> result;
+    result.reserve(header_->affiliationCount);
+    for (std::uint32_t node = 0; node < nodeCount_; ++node) {
+        if (nodes_[node].exists) {
+            result.push_back(nodeID(node));
+        }
+    }
+    return result;
+}
+
+Name MappedImage::get_affiliation_name(const AffiliationID& id) const
+{
+    std::uint32_t node = findAffiliation(id);
+    return node == image::NONE ? NO_NAME : Name(text(nodes_[node].name));
+}
+
+Coord MappedImage::get_affiliation_coord(const AffiliationID& id) const
+{
+    std::uint32_t node = findAffiliation(id);
+    return node == image::NONE ? NO_COORD : Coord{nodes_[node].x, nodes_[node].y};
+}
+
+std::vector<AffiliationID> MappedImage::get_affiliations_alphabetically() const
+{
+    std::vector<AffiliationID> result;
+    result.reserve(nameOrderCount_);
+    for (std::size_t i = 0; i < nameOrderCount_; ++i) {
+        result.push_back(nodeID(nameOrder_[i]));
+    }
+    return result;
+}
+
+std::vector<AffiliationID> MappedImage::get_affiliations_distance_increasing() const
+{
+    std::vector<AffiliationID> result;
+    result.reserve(distanceOrderCount_);
+    for (std::size_t i = 0; i < distanceOrderCount_; ++i) {
+        result.push_back(nodeID(distanceOrder_[i]));
+    }
+    return result;
+}
+
+AffiliationID MappedImage::find_affiliation_with_coord(Coord xy) const
+{
+    auto it = std::lower_bound(coordIndex_, coordIndex_ + coordIndexCount_, xy,
+                               [](const image::CoordEntry& entry, Coord key) { return Coord{entry.x, entry.y} < key; });
+    if (it == coordIndex_ + coordIndexCount_ || Coord{it->x, it->y} != xy) {
+        return NO_AFFILIATION;
+    }
+    return nodeID(it->node);
+}
+
+std::vector<PublicationID> MappedImage::all_publications() const
+{
+    std::vector<PublicationID> result;
+    result.reserve(publicationCount_);
+    for (std::size_t i = 0; i < publicationCount_; ++i) {
+        result.push_back(publications_[i].id);
+    }
+    return result;
+}
+
+Name MappedImage::get_publication_name(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    return publication == image::NONE ? NO_NAME : Name(text(publications_[publication].title));
+}
+
+Year MappedImage::get_publication_year(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    return publication == image::NONE ? NO_YEAR : publications_[publication].year;
+}
+
+std::vector<AffiliationID> MappedImage::get_affiliations(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE) {
+        return {NO_AFFILIATION};
+    }
+
+    const image::Publication& record = publications_[publication];
+    std::vector<AffiliationID> result;
+    result.reserve(record.affiliationCount);
+    for (std::uint32_t i = 0; i < record.affiliationCount; ++i) {
+        result.push_back(nodeID(publicationNodes_[record.affiliationBegin + i]));
+    }
+    return result;
+}
+
+std::vector<PublicationID> MappedImage::get_direct_references(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE) {
+        return {NO_PUBLICATION};
+    }
+
+    const image::Publication& record = publications_[publication];
+    std::vector<PublicationID> result;
+    result.reserve(record.referenceCount);
+    for (std::uint32_t i = 0; i < record.referenceCount; ++i) {
+        result.push_back(publications_[publicationReferences_[record.referenceBegin + i]].id);
+    }
+    return result;
+}
+
+std::vector<PublicationID> MappedImage::get_publications(const AffiliationID& id) const
+{
+    std::uint32_t node = findAffiliation(id);
+    if (node == image::NONE) {
+        return {NO_PUBLICATION};
+    }
+
+    const image::Node& record = nodes_[node];
+    std::vector<PublicationID> result;
+    result.reserve(record.publicationCount);
+    for (std::uint32_t i = 0; i < record.publicationCount; ++i) {
+        result.push_back(publications_[nodePublications_[record.publicationBegin + i]].id);
+    }
+    return result;
+}
+
+PublicationID MappedImage::get_parent(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE || publications_[publication].parent == image::NONE) {
+        return NO_PUBLICATION;
+    }
+    return publications_[publications_[publication].parent].id;
+}
+
+std::vector<std::pair<Year, PublicationID>> MappedImage::get_publications_after(const AffiliationID& affiliationid, Year year) const
+{
+    std::uint32_t node = findAffiliation(affiliationid);
+    if (node == image::NONE) {
+        return {{NO_YEAR, NO_PUBLICATION}};
+    }
+
+    const image::Node& record = nodes_[node];
+    std::vector<std::pair<Year, PublicationID>> result;
+    for (std::uint32_t i = 0; i < record.publicationCount; ++i) {
+        const image::Publication& publication = publications_[nodePublications_[record.publicationBegin + i]];
+        if (publication.year >= year) {
+            result.emplace_back(publication.year, publication.id);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<PublicationID> MappedImage::get_referenced_by_chain(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE) {
+        return {NO_PUBLICATION};
+    }
+
+    std::vector<PublicationID> result;
+    result.reserve(publications_[publication].depth);
+    for (std::uint32_t parent = publications_[publication].parent; parent != image::NONE; parent = publications_[parent].parent) {
+        result.push_back(publications_[parent].id);
+    }
+    return result;
+}
+
+std::uint32_t MappedImage::ancestorAtDepth(std::uint32_t publication, std::uint32_t depth) const
+{
+    while (publications_[publication].depth > depth) {
+        std::uint32_t jump = publications_[publication].jump;
+        publication = (publications_[jump].depth >= depth) ? jump : publications_[publication].parent;
+    }
+    return publication;
+}
+
+PublicationID MappedImage::get_ancestor_at_depth(PublicationID id, unsigned int depth) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE || depth > publications_[publication].depth) {
+        return NO_PUBLICATION;
+    }
+    return publications_[ancestorAtDepth(publication, depth)].id;
+}
+
+std::vector<PublicationID> MappedImage::get_all_references(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    if (publication == image::NONE) {
+        return {NO_PUBLICATION};
+    }
+
+    // The references are the rest of the publication's preorder range
+    const image::Publication& record = publications_[publication];
+    std::vector<PublicationID> result;
+    result.reserve(record.size - 1);
+    for (std::uint32_t i = record.preorder + 1; i < record.preorder + record.size; ++i) {
+        result.push_back(publications_[preorder_[i]].id);
+    }
+    return result;
+}
+
+unsigned int MappedImage::count_all_references(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    return publication == image::NONE ? NO_COUNT : publications_[publication].size - 1;
+}
+
+unsigned int MappedImage::get_citation_depth(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    return publication == image::NONE ? NO_COUNT : publications_[publication].depth;
+}
+
+unsigned int MappedImage::get_subtree_size(PublicationID id) const
+{
+    std::uint32_t publication = findPublication(id);
+    return publication == image::NONE ? NO_COUNT : publications_[publication].size;
+}
+
+std::vector<PublicationID> MappedImage::get_most_cited(unsigned int k) const
+{
+    std::size_t count = std::min<std::size_t>(k, citationOrderCount_);
+    std::vector<PublicationID> result;
+    result.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        result.push_back(publications_[citationOrder_[i]].id);
+    }
+    return result;
+}
+
+std::vector<AffiliationID> MappedImage::get_affiliations_closest_to(Coord xy) const
+{
+    std::vector<std::uint32_t> nodes;
+    nodes.reserve(header_->affiliationCount);
+    for (std::uint32_t node = 0; node < nodeCount_; ++node) {
+        if (nodes_[node].exists) {
+            nodes.push_back(node);
+        }
+    }
+
+    // Same order as Datastructures: whole distance units to xy, then the smaller y first
+    auto distance = [&](std::uint32_t node) {
+        return static_cast<Distance>(std::sqrt(std::pow(nodes_[node].x - xy.x, 2) + std::pow(nodes_[node].y - xy.y, 2)));
+    };
+    auto closer = [&](std::uint32_t a, std::uint32_t b) {
+        Distance distanceA = distance(a);
+        Distance distanceB = distance(b);
+        return distanceA == distanceB ? nodes_[a].y < nodes_[b].y : distanceA < distanceB;
+    };
+    std::size_t count = std::min<std::size_t>(3, nodes.size());
+    std::partial_sort(nodes.begin(), nodes.begin() + count, nodes.end(), closer);
+
+    std::vector<AffiliationID> result;
+    for (std::size_t i = 0; i < count; ++i) {
+        result.push_back(nodeID(nodes[i]));
+    }
+    return result;
+}
+
+PublicationID MappedImage::get_closest_common_parent(PublicationID id1, PublicationID id2) const
+{
+    std::uint32_t a = findPublication(id1);
+    std::uint32_t b = findPublication(id2);
+    if (a == image::NONE || b == image::NONE) {
+        return NO_PUBLICATION;
+    }
+
+    std::uint32_t first = a;
+    std::uint32_t second = b;
+    if (publications_[a].depth > publications_[b].depth) {
+        a = ancestorAtDepth(a, publications_[b].depth);
+    } else {
+        b = ancestorAtDepth(b, publications_[a].depth);
+    }
+    while (a != b) {
+        if (publications_[a].parent == image::NONE) {
+            return NO_PUBLICATION; // Different trees
+        }
+        if (publications_[a].jump != publications_[b].jump) {
+            a = publications_[a].jump;
+            b = publications_[b].jump;
+        } else {
+            a = publications_[a].parent;
+            b = publications_[b].parent;
+        }
+    }
+
+    // A publication doesn't count as its own common parent
+    if (a == first || a == second) {
+        a = publications_[a].parent;
+    }
+    return a == image::NONE ? NO_PUBLICATION : publications_[a].id;
+}
+
+Connection MappedImage::connection(std::uint32_t node, const image::Edge& edge) const
+{
+    return Connection{nodeID(node), nodeID(edge.node), edge.weight};
+}
+
+std::vector<Connection> MappedImage::get_connected_affiliations(const AffiliationID& id) const
+{
+    std::uint32_t node = findAffiliation(id);
+    if (node == image::NONE) {
+        return {};
+    }
+
+    std::vector<Connection> result;
+    result.reserve(nodes_[node].edgeCount);
+    for (std::uint64_t i = 0; i < nodes_[node].edgeCount; ++i) {
+        result.push_back(connection(node, edges_[nodes_[node].edgeBegin + i]));
+    }
+    return result;
+}
+
+std::vector<Connection> MappedImage::get_all_connections() const
+{
+    // Nodes are sorted by ID, so every connection is listed once from its smaller end.
+    // A publication naming the same affiliation twice leaves a loop in the list twice,
+    // those are listed once per weight like Datastructures does.
+    std::vector<Connection> result;
+    std::vector<Weight> loopWeights;
+    for (std::uint32_t node = 0; node < nodeCount_; ++node) {
+        loopWeights.clear();
+        for (std::uint64_t i = 0; i < nodes_[node].edgeCount; ++i) {
+            const image::Edge& edge = edges_[nodes_[node].edgeBegin + i];
+            if (node == edge.node) {
+                if (std::find(loopWeights.begin(), loopWeights.end(), edge.weight) != loopWeights.end()) {
+                    continue;
+                }
+                loopWeights.push_back(edge.weight);
+            }
+            if (node <= edge.node) {
+                result.push_back(connection(node, edge));
+            }
+        }
+    }
+    return result;
+}
+
+Path MappedImage::pathTo(std::uint32_t source, std::uint32_t target, const std::vector<std::uint32_t>& parent) const
+{
+    Path path;
+    for (std::uint32_t current = target; current != source; current = parent[current]) {
+        std::uint32_t previous = parent[current];
+        const image::Node& record = nodes_[previous];
+        for (std::uint64_t i = 0; i < record.edgeCount; ++i) {
+            if (edges_[record.edgeBegin + i].node == current) {
+                path.push_back(connection(previous, edges_[record.edgeBegin + i]));
+                break;
+            }
+        }
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+Path MappedImage::get_any_path(const AffiliationID& source, const AffiliationID& target) const
+{
+    std::uint32_t from = findNode(source);
+    std::uint32_t to = findNode(target);
+    if (from == image::NONE || to == image::NONE || from == to) {
+        return {};
+    }
+
+    // Depth-first search in the same order as Datastructures
+    std::vector<char> visited(nodeCount_, false);
+    std::vector<std::uint32_t> parent(nodeCount_, image::NONE);
+    std::stack<std::uint32_t> stack;
+    stack.push(from);
+    visited[from] = true;
+    while (!stack.empty()) {
+        std::uint32_t current = stack.top();
+        stack.pop();
+        for (std::uint64_t i = 0; i < nodes_[current].edgeCount; ++i) {
+            std::uint32_t next = edges_[nodes_[current].edgeBegin + i].node;
+            if (!visited[next]) {
+                stack.push(next);
+                visited[next] = true;
+                parent[next] = current;
+            }
+        }
+    }
+
+    return visited[to] ? pathTo(from, to, parent) : Path();
+}
+
+Path MappedImage::get_path_with_least_affiliations(const AffiliationID& source, const AffiliationID& target) const
+{
+    std::uint32_t from = findAffiliation(source);
+    std::uint32_t to = findAffiliation(target);
+    if (from == image::NONE || to == image::NONE) {
+        return {};
+    }
+
+    std::vector<char> visited(nodeCount_, false);
+    std::vector<std::uint32_t> parent(nodeCount_, image::NONE);
+    std::queue<std::uint32_t> queue;
+    queue.push(from);
+    visited[from] = true;
+    while (!queue.empty()) {
+        std::uint32_t current = queue.front();
+        queue.pop();
+        if (current == to) {
+            return pathTo(from, to, parent);
+        }
+        for (std::uint64_t i = 0; i < nodes_[current].edgeCount; ++i) {
+            std::uint32_t next = edges_[nodes_[current].edgeBegin + i].node;
+            if (!visited[next]) {
+                visited[next] = true;
+                parent[next] = current;
+                queue.push(next);
+            }
+        }
+    }
+    return {};
+}
+
+Path MappedImage::get_path_of_least_friction(const AffiliationID& source, const AffiliationID& target) const
+{
+    std::uint32_t from = findAffiliation(source);
+    std::uint32_t to = findAffiliation(target);
+    if (from == image::NONE || to == image::NONE) {
+        return {};
+    }
+
+    // Same search as Datastructures. Node numbers follow ID order, so ties
+    // in the queue are broken the same way as with the IDs themselves.
+    std::vector<char> visited(nodeCount_, false);
+    std::vector<std::uint32_t> parent(nodeCount_, image::NONE);
+    std::priority_queue<std::pair<Weight, std::uint32_t>> queue;
+    queue.push({0, from});
+    visited[from] = true;
+
+    Path maxPath;
+    Weight maxWeight = 0;
+    while (!queue.empty()) {
+        auto [currentWeight, current] = queue.top();
+        queue.pop();
+        if (current == to && currentWeight > maxWeight) {
+            maxWeight = currentWeight;
+            maxPath = pathTo(from, to, parent);
+        }
+        for (std::uint64_t i = 0; i < nodes_[current].edgeCount; ++i) {
+            const image::Edge& edge = edges_[nodes_[current].edgeBegin + i];
+            if (!visited[edge.node]) {
+                visited[edge.node] = true;
+                parent[edge.node] = current;
+                queue.push({currentWeight + edge.weight, edge.node});
+            }
+        }
+    }
+    return maxPath;
+}
+
+PathWithDist MappedImage::get_shortest_path(const AffiliationID& source, const AffiliationID& target) const
+{
+    std::uint32_t from = findAffiliation(source);
+    std::uint32_t to = findAffiliation(target);
+    if (from == image::NONE || to == image::NONE) {
+        return {};
+    }
+
+    std::vector<char> visited(nodeCount_, false);
+    std::vector<Distance> distance(nodeCount_, NO_DISTANCE);
+    std::vector<std::uint32_t> parent(nodeCount_, image::NONE);
+    std::priority_queue<std::pair<Distance, std::uint32_t>> queue;
+    distance[from] = 0;
+    queue.push({0, from});
+
+    while (!queue.empty()) {
+        std::uint32_t current = queue.top().second;
+        queue.pop();
+
+        if (current == to) {
+            PathWithDist result;
+            for (std::uint32_t node = to; node != from; node = parent[node]) {
+                std::uint32_t previous = parent[node];
+                const image::Node& record = nodes_[previous];
+                for (std::uint64_t i = 0; i < record.edgeCount; ++i) {
+                    if (edges_[record.edgeBegin + i].node == node) {
+                        result.push_back({connection(previous, edges_[record.edgeBegin + i]), distance[node] - distance[previous]});
+                        break;
+                    }
+                }
+            }
+            std::reverse(result.begin(), result.end());
+            return result;
+        }
+        visited[current] = true;
+
+        // Only existing affiliations have coordinates to measure with
+        if (!nodes_[current].exists) {
+            continue;
+        }
+        for (std::uint64_t i = 0; i < nodes_[current].edgeCount; ++i) {
+            std::uint32_t other = edges_[nodes_[current].edgeBegin + i].node;
+            if (visited[other] || !nodes_[other].exists) {
+                continue;
+            }
+
+            Distance length = static_cast<Distance>(std::sqrt(std::pow(nodes_[current].x - nodes_[other].x, 2) +
+                                                              std::pow(nodes_[current].y - nodes_[other].y, 2)));
+            Distance total = distance[current] + length;
+            if (distance[other] == NO_DISTANCE || total < distance[other]) {
+                distance[other] = total;
+                parent[other] = current;
+                queue.push({-total, other});
+            }
+        }
+    }
+    return {};
+}
@@ -0,0 +1,221 @@
+// MappedImage.hh
+//
+// Read-only image of a whole data set. The image is one flat file that is
+// mapped into memory and queried in place, nothing is deserialized on open.
+
+#ifndef MAPPEDIMAGE_HH
+#define MAPPEDIMAGE_HH
+
+#include "datastructures.hh"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-disk layout. Everything refers to other parts of the file by offset or
+// index, so the image works wherever it is mapped and processes mapping the
+// same file share its pages.
+namespace image
+{
+std::uint32_t const NONE = std::numeric_limits<std::uint32_t>::max();
+
+char const MAGIC[8] = {'P', 'R', 'G', '2', 'I', 'M', 'G', '\0'};
+std::uint32_t const VERSION = 1;
+std::uint32_t const BYTE_ORDER_MARK = 0x01020304;
+
+// Offset and length in the string table
+struct StringRef
+{
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// Every affiliation ID met anywhere, sorted by ID. IDs only named by a
+// publication or a connection are kept too, with exists set to 0.
+struct Node
+{
+    StringRef id;
+    StringRef name;
+    std::int32_t x;
+    std::int32_t y;
+    std::uint32_t exists;
+    std::uint32_t publicationCount;
+    std::uint64_t publicationBegin; // into NODE_PUBLICATIONS
+    std::uint64_t edgeBegin;        // into EDGES
+    std::uint64_t edgeCount;
+};
+
+// Publications sorted by ID, with the reference forest flattened in preorder
+struct Publication
+{
+    std::uint64_t id;
+    StringRef title;
+    std::uint32_t year;
+    std::uint32_t parent;
+    std::uint32_t jump;
+    std::uint32_t depth;
+    std::uint32_t size;
+    std::uint32_t preorder;
+    std::uint32_t affiliationCount;
+    std::uint32_t referenceCount;
+    std::uint64_t affiliationBegin; // into PUBLICATION_NODES
+    std::uint64_t referenceBegin;   // into PUBLICATION_REFERENCES
+};
+
+struct Edge
+{
+    std::uint32_t node;
+    std::int32_t weight;
+};
+
+struct CoordEntry
+{
+    std::int32_t x;
+    std::int32_t y;
+    std::uint32_t node;
+    std::uint32_t pad;
+};
+
+enum SectionIndex
+{
+    STRINGS, NODES, PUBLICATIONS, NODE_PUBLICATIONS, PUBLICATION_NODES, PUBLICATION_REFERENCES,
+    PREORDER, EDGES, NAME_ORDER, DISTANCE_ORDER, COORD_INDEX, CITATION_ORDER, SECTION_COUNT
+};
+
+struct Section
+{
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint64_t affiliationCount;
+    Section sections[SECTION_COUNT];
+};
+
+// Collects the sections in memory and writes them out behind the header
+struct Builder
+{
+    std::string strings;
+    std::vector<Node> nodes;
+    std::vector<Publication> publications;
+    std::vector<std::uint32_t> nodePublications;
+    std::vector<std::uint32_t> publicationNodes;
+    std::vector<std::uint32_t> publicationReferences;
+    std::vector<std::uint32_t> preorder;
+    std::vector<Edge> edges;
+    std::vector<std::uint32_t> nameOrder;
+    std::vector<std::uint32_t> distanceOrder;
+    std::vector<CoordEntry> coordIndex;
+    std::vector<std::uint32_t> citationOrder;
+    std::uint64_t affiliationCount = 0;
+
+    StringRef addString(const std::string& text);
+    bool write(std::ostream& output) const;
+};
+}
+
+class MappedImage
+{
+public:
+    // Maps the file read-only, returns nullptr if it is missing or not a valid image.
+    // Every record's string offsets, ranges and indices are checked before it is used.
+    static std::unique_ptr<MappedImage> open(const std::string& filename);
+    ~MappedImage();
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    // Size of the mapping (or of the copy where mapping is not available)
+    std::size_t mapped_bytes() const { return size_; }
+
+    // The read queries of Datastructures, answered from the image
+    unsigned int get_affiliation_count() const;
+    std::vector<AffiliationID> get_all_affiliations() const;
+    Name get_affiliation_name(const AffiliationID& id) const;
+    Coord get_affiliation_coord(const AffiliationID& id) const;
+    std::vector<AffiliationID> get_affiliations_alphabetically() const;
+    std::vector<AffiliationID> get_affiliations_distance_increasing() const;
+    AffiliationID find_affiliation_with_coord(Coord xy) const;
+    std::vector<PublicationID> all_publications() const;
+    Name get_publication_name(PublicationID id) const;
+    Year get_publication_year(PublicationID id) const;
+    std::vector<AffiliationID> get_affiliations(PublicationID id) const;
+    std::vector<PublicationID> get_direct_references(PublicationID id) const;
+    std::vector<PublicationID> get_publications(const AffiliationID& id) const;
+    PublicationID get_parent(PublicationID id) const;
+    std::vector<std::pair<Year, PublicationID>> get_publications_after(const AffiliationID& affiliationid, Year year) const;
+    std::vector<PublicationID> get_referenced_by_chain(PublicationID id) const;
+    PublicationID get_ancestor_at_depth(PublicationID id, unsigned int depth) const;
+    std::vector<PublicationID> get_all_references(PublicationID id) const;
+    unsigned int count_all_references(PublicationID id) const;
+    unsigned int get_citation_depth(PublicationID id) const;
+    unsigned int get_subtree_size(PublicationID id) const;
+    std::vector<PublicationID> get_most_cited(unsigned int k) const;
+    std::vector<AffiliationID> get_affiliations_closest_to(Coord xy) const;
+    PublicationID get_closest_common_parent(PublicationID id1, PublicationID id2) const;
+    std::vector<Connection> get_connected_affiliations(const AffiliationID& id) const;
+    std::vector<Connection> get_all_connections() const;
+    Path get_any_path(const AffiliationID& source, const AffiliationID& target) const;
+    Path get_path_with_least_affiliations(const AffiliationID& source, const AffiliationID& target) const;
+    Path get_path_of_least_friction(const AffiliationID& source, const AffiliationID& target) const;
+    PathWithDist get_shortest_path(const AffiliationID& source, const AffiliationID& target) const;
+
+private:
+    MappedImage() = default;
+    bool attach(const char* data, std::size_t size);
+    bool validate() const;
+
+    template <typename Type>
+    bool section(image::SectionIndex index, const Type*& items, std::size_t& count) const;
+
+    std::string_view text(image::StringRef ref) const;
+    AffiliationID nodeID(std::uint32_t node) const;
+    std::uint32_t findNode(const AffiliationID& id) const;
+    std::uint32_t findAffiliation(const AffiliationID& id) const;
+    std::uint32_t findPublication(PublicationID id) const;
+    std::uint32_t ancestorAtDepth(std::uint32_t publication, std::uint32_t depth) const;
+    Connection connection(std::uint32_t node, const image::Edge& edge) const;
+    Path pathTo(std::uint32_t source, std::uint32_t target, const std::vector<std::uint32_t>& parent) const;
+
+    // Either a mapping of the file or, where mapping is not available, a copy of it
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> buffer_;
+
+    const image::Header* header_ = nullptr;
+    const char* strings_ = nullptr;
+    const image::Node* nodes_ = nullptr;
+    const image::Publication* publications_ = nullptr;
+    const std::uint32_t* nodePublications_ = nullptr;
+    const std::uint32_t* publicationNodes_ = nullptr;
+    const std::uint32_t* publicationReferences_ = nullptr;
+    const std::uint32_t* preorder_ = nullptr;
+    const image::Edge* edges_ = nullptr;
+    const std::uint32_t* nameOrder_ = nullptr;
+    const std::uint32_t* distanceOrder_ = nullptr;
+    const image::CoordEntry* coordIndex_ = nullptr;
+    const std::uint32_t* citationOrder_ = nullptr;
+    std::size_t stringCount_ = 0;
+    std::size_t nodeCount_ = 0;
+    std::size_t publicationCount_ = 0;
+    std::size_t nodePublicationCount_ = 0;
+    std::size_t publicationNodeCount_ = 0;
+    std::size_t publicationReferenceCount_ = 0;
+    std::size_t preorderCount_ = 0;
+    std::size_t edgeCount_ = 0;
+    std::size_t nameOrderCount_ = 0;
+    std::size_t distanceOrderCount_ = 0;
+    std::size_t coordIndexCount_ = 0;
+    std::size_t citationOrderCount_ = 0;
+};
+
+#endif // MAPPEDIMAGE_HH
@@ -17,9 +17,17 @@
 # "Rebuild all" from the Build menu
 #  QMAKE_CXXFLAGS += -DUSE_PERF_EVENT
 
+# Uncomment the lines below to build with ThreadSanitizer, which reports data races found while running
+# the multi-threaded commands such as perftest_concurrent and concurrency_test
+# NOTE 1: ThreadSanitizer makes the program many times slower, so don't enable it when running performance tests!
+# NOTE 2: If you uncomment or recomment the lines, remember to recompile EVERYTHING by selecting
+# "Rebuild all" from the Build menu
+#QMAKE_CXXFLAGS += -fsanitize=thread -g
+#QMAKE_LFLAGS += -fsanitize=thread
+
 QT       += core gui
 
-CONFIG += c++17 warn_on
+CONFIG += c++17 warn_on thread
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -37,16 +45,28 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Git revision of the sources, recorded in perftest result files
+GIT_REVISION = $$system(git -C \"$$PWD\" rev-parse --short HEAD)
+!isEmpty(GIT_REVISION): DEFINES += GIT_REVISION=\\\"$$GIT_REVISION\\\"
+
 
 SOURCES += \
     datastructures.cc \
     mainwindow.cc \
-    mainprogram.cc
+    mainprogram.cc \
+    mappedimage.cc \
+    scheduler.cc \
+    versioneddatastructures.cc \
+    writeaheadlog.cc
 
 HEADERS += \
     datastructures.hh \
     mainwindow.hh \
-    mainprogram.hh
+    mainprogram.hh \
+    mappedimage.hh \
+    scheduler.hh \
+    versioneddatastructures.hh \
+    writeaheadlog.hh
 
 exists(worldmap/worldmap.hh) {
     HEADERS += worldmap/worldmap.hh
@@ -0,0 +1,254 @@
+// Scheduler.cc
+
+#include "scheduler.hh"
+
+#include <deque>
+#include <thread>
+
+namespace
+{
+// Fork-join calls make up to this many chunks per thread, so that threads
+// finishing early have something left to steal
+std::size_t const CHUNKS_PER_THREAD = 4;
+
+// The scheduler whose worker the current thread is, and its index
+thread_local const Scheduler* currentScheduler = nullptr;
+thread_local std::size_t currentWorker = 0;
+}
+
+struct Scheduler::Worker
+{
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+    Counters counters;
+};
+
+Scheduler& Scheduler::instance()
+{
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+Scheduler::Scheduler(unsigned int threadCount)
+{
+    start(threadCount);
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+unsigned int Scheduler::thread_count() const
+{
+    return static_cast<unsigned int>(workers_.size()) + 1;
+}
+
+void Scheduler::set_thread_count(unsigned int threadCount)
+{
+    stop();
+    start(threadCount);
+}
+
+void Scheduler::parallel_invoke(const std::vector<std::function<void()>>& functions)
+{
+    if (workers_.empty() || functions.size() < 2) {
+        for (const auto& function : functions) {
+            function();
+        }
+        return;
+    }
+
+    Join join;
+    for (std::size_t i = 1; i < functions.size(); ++i) {
+        submit(joined(join, std::cref(functions[i])));
+    }
+    try {
+        functions.front()();
+    } catch (...) {
+        join.fail(std::current_exception());
+    }
+    wait(join);
+}
+
+std::vector<Scheduler::WorkerStats> Scheduler::stats() const
+{
+    auto read = [](const Counters& counters) {
+        WorkerStats stats;
+        stats.tasks = counters.tasks.load(std::memory_order_relaxed);
+        stats.steals = counters.steals.load(std::memory_order_relaxed);
+        stats.busySeconds = counters.busyNanoseconds.load(std::memory_order_relaxed) / 1e9;
+        return stats;
+    };
+
+    std::vector<WorkerStats> result;
+    for (const auto& worker : workers_) {
+        result.push_back(read(worker->counters));
+    }
+    result.push_back(read(callerCounters_));
+    return result;
+}
+
+double Scheduler::stats_seconds() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart_).count();
+}
+
+void Scheduler::reset_stats()
+{
+    auto reset = [](Counters& counters) {
+        counters.tasks.store(0, std::memory_order_relaxed);
+        counters.steals.store(0, std::memory_order_relaxed);
+        counters.busyNanoseconds.store(0, std::memory_order_relaxed);
+    };
+    for (auto& worker : workers_) {
+        reset(worker->counters);
+    }
+    reset(callerCounters_);
+    statsStart_ = std::chrono::steady_clock::now();
+}
+
+void Scheduler::Join::fail(std::exception_ptr exception)
+{
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!error) {
+        error = exception;
+    }
+}
+
+std::size_t Scheduler::chunkSize(std::size_t count, std::size_t grain) const
+{
+    grain = std::max<std::size_t>(grain, 1);
+    if (workers_.empty()) {
+        return std::max(count, grain);
+    }
+    if (count == 0) {
+        return grain;
+    }
+    std::size_t chunks = std::min((count + grain - 1) / grain, thread_count() * CHUNKS_PER_THREAD);
+    std::size_t chunk = (count + chunks - 1) / chunks;
+    return (chunk + grain - 1) / grain * grain;
+}
+
+void Scheduler::submit(Task task)
+{
+    // Workers push to their own deque, other threads spread their tasks over the workers
+    std::size_t target = currentScheduler == this ? currentWorker : nextWorker_++ % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        ++queued_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+        workers_[target]->tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+bool Scheduler::runOne()
+{
+    bool isWorker = currentScheduler == this;
+    Task task;
+    bool stolen = false;
+
+    if (isWorker) {
+        Worker& own = *workers_[currentWorker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+
+    // Other workers are tried in turn starting from the next one. A thief takes the oldest
+    // task, away from the end where the owner keeps pushing and popping.
+    std::size_t first = isWorker ? currentWorker + 1 : nextWorker_.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; !task && i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(first + i) % workers_.size()];
+        if (isWorker && &victim == workers_[currentWorker].get()) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            stolen = true;
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        --queued_;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    task();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+
+    Counters& counters = isWorker ? workers_[currentWorker]->counters : callerCounters_;
+    counters.tasks.fetch_add(1, std::memory_order_relaxed);
+    counters.steals.fetch_add(stolen ? 1 : 0, std::memory_order_relaxed);
+    counters.busyNanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    return true;
+}
+
+void Scheduler::wait(Join& join)
+{
+    // Running other tasks while waiting keeps nested calls from tying up all threads
+    while (join.pending.load(std::memory_order_acquire) != 0) {
+        if (!runOne()) {
+            std::this_thread::yield();
+        }
+    }
+    if (join.error) {
+        std::rethrow_exception(join.error);
+    }
+}
+
+void Scheduler::work(std::size_t index)
+{
+    currentScheduler = this;
+    currentWorker = index;
+    while (true) {
+        if (runOne()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+void Scheduler::start(unsigned int threadCount)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    stopping_ = false;
+    for (unsigned int i = 1; i < threadCount; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->thread = std::thread(&Scheduler::work, this, i);
+    }
+    reset_stats();
+}
+
+void Scheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+    workers_.clear();
+}
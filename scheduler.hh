@@ -0,0 +1,187 @@
+// Scheduler.hh
+//
+// Work-stealing thread pool shared by the parallel operations. Every worker
+// has a deque of tasks: it runs its own newest task first and, when it has
+// none left, steals the oldest task of another worker. A fork-join call
+// splits its range into tasks and the calling thread runs tasks too until its
+// own are done, so parallel calls can be made from inside tasks.
+
+#ifndef SCHEDULER_HH
+#define SCHEDULER_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class Scheduler
+{
+public:
+    // The pool shared by the whole program
+    static Scheduler& instance();
+
+    // threadCount counts the calling thread, so one less worker is started. 0 means one per hardware thread.
+    explicit Scheduler(unsigned int threadCount = 0);
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Threads that run a fork-join call, the calling thread included
+    unsigned int thread_count() const;
+
+    // Replaces the workers once the queued tasks are done and resets the statistics.
+    // Must not be called while parallel calls are running.
+    void set_thread_count(unsigned int threadCount);
+
+    // Runs body(begin, end) over [0, count) in chunks whose size is a multiple of grain
+    // and returns when all chunks are done. An exception from a chunk is rethrown.
+    template <typename Body>
+    void parallel_for(std::size_t count, std::size_t grain, const Body& body);
+
+    // Like parallel_for, but body(begin, end) returns a result and the results of the
+    // chunks are folded in range order with combine(result, chunkresult), starting from identity
+    template <typename Type, typename Body, typename Combine>
+    Type parallel_reduce(std::size_t count, std::size_t grain, Type identity, const Body& body, const Combine& combine);
+
+    // Runs the functions side by side and returns when all of them are done
+    void parallel_invoke(const std::vector<std::function<void()>>& functions);
+
+    // Runs function on a worker, its result (or exception) is delivered through the future.
+    // Without workers the function is run right away.
+    template <typename Function>
+    auto async(Function function) -> std::future<decltype(function())>;
+
+    struct WorkerStats
+    {
+        unsigned long tasks = 0;  // Tasks run
+        unsigned long steals = 0; // Tasks taken from the deque of another worker
+        double busySeconds = 0;   // Time spent running tasks
+    };
+
+    // Statistics of every worker since the last reset. The last entry is for the
+    // threads that called fork-join operations and ran tasks while waiting.
+    std::vector<WorkerStats> stats() const;
+    double stats_seconds() const;
+    void reset_stats();
+
+private:
+    using Task = std::function<void()>;
+    struct Worker;
+
+    struct Counters
+    {
+        std::atomic<unsigned long> tasks{0};
+        std::atomic<unsigned long> steals{0};
+        std::atomic<long long> busyNanoseconds{0};
+    };
+
+    // The tasks of one fork-join call still running, and the first exception thrown by them
+    struct Join
+    {
+        std::atomic<std::size_t> pending{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        void fail(std::exception_ptr exception);
+    };
+
+    template <typename Function>
+    Task joined(Join& join, Function function);
+
+    std::size_t chunkSize(std::size_t count, std::size_t grain) const;
+    void submit(Task task);
+    bool runOne();
+    void wait(Join& join);
+    void work(std::size_t index);
+    void start(unsigned int threadCount);
+    void stop();
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    Counters callerCounters_;
+    std::atomic<std::size_t> nextWorker_{0};
+    std::chrono::steady_clock::time_point statsStart_;
+
+    // Idle workers sleep until a task is queued
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::size_t queued_ = 0;
+    bool stopping_ = false;
+};
+
+template <typename Function>
+Scheduler::Task Scheduler::joined(Join& join, Function function)
+{
+    join.pending.fetch_add(1, std::memory_order_relaxed);
+    return [&join, function]() {
+        try {
+            function();
+        } catch (...) {
+            join.fail(std::current_exception());
+        }
+        join.pending.fetch_sub(1, std::memory_order_release);
+    };
+}
+
+template <typename Body>
+void Scheduler::parallel_for(std::size_t count, std::size_t grain, const Body& body)
+{
+    std::size_t chunk = chunkSize(count, grain);
+    if (chunk >= count) {
+        if (count > 0) {
+            body(0, count);
+        }
+        return;
+    }
+
+    Join join;
+    for (std::size_t begin = chunk; begin < count; begin += chunk) {
+        std::size_t end = std::min(count, begin + chunk);
+        submit(joined(join, [&body, begin, end]() { body(begin, end); }));
+    }
+    try {
+        body(0, chunk);
+    } catch (...) {
+        join.fail(std::current_exception());
+    }
+    wait(join);
+}
+
+template <typename Type, typename Body, typename Combine>
+Type Scheduler::parallel_reduce(std::size_t count, std::size_t grain, Type identity, const Body& body, const Combine& combine)
+{
+    std::size_t chunk = chunkSize(count, grain);
+    std::vector<Type> results((count + chunk - 1) / chunk, identity);
+    parallel_for(count, chunk, [&](std::size_t begin, std::size_t end) {
+        results[begin / chunk] = body(begin, end);
+    });
+
+    Type result = std::move(identity);
+    for (Type& chunkResult : results) {
+        result = combine(std::move(result), std::move(chunkResult));
+    }
+    return result;
+}
+
+template <typename Function>
+auto Scheduler::async(Function function) -> std::future<decltype(function())>
+{
+    auto task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+    std::future<decltype(function())> result = task->get_future();
+    if (workers_.empty()) {
+        (*task)();
+    } else {
+        submit([task]() { (*task)(); });
+    }
+    return result;
+}
+
+#endif // SCHEDULER_HH
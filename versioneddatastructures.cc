@@ -0,0 +1,143 @@
+// VersionedDatastructures.cc
+
+#include "versioneddatastructures.hh"
+
+#include <chrono>
+#include <sstream>
+
+VersionedDatastructures::VersionedDatastructures(unsigned int publishEvery)
+    : published_(std::make_shared<Copy>()), standby_(std::make_shared<Copy>()), publishEvery_(publishEvery)
+{
+    // The third copy starts out retired, ready to be the next standby
+    retired_.push_back(std::make_shared<Copy>());
+    std::atomic_store(&current_, makeSnapshot(published_, version_));
+}
+
+std::shared_ptr<const VersionedDatastructures::Snapshot> VersionedDatastructures::snapshot() const
+{
+    return std::atomic_load(&current_);
+}
+
+bool VersionedDatastructures::write(Mutation mutation)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    catchUp();
+
+    bool result = mutation(standby_->data);
+    unpublished_.push_back(std::move(mutation));
+
+    if (publishEvery_ != 0 && unpublished_.size() >= publishEvery_) {
+        publishLocked();
+    }
+    return result;
+}
+
+void VersionedDatastructures::publish()
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    publishLocked();
+}
+
+std::uint64_t VersionedDatastructures::version() const
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    return version_;
+}
+
+unsigned long VersionedDatastructures::copies_made() const
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    return copiesMade_;
+}
+
+unsigned long VersionedDatastructures::writer_waits() const
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    return writerWaits_;
+}
+
+void VersionedDatastructures::publishLocked()
+{
+    catchUp();
+    if (unpublished_.empty()) {
+        return;
+    }
+
+    // Every copy but the standby misses the new version's mutations
+    Batch batch = std::make_shared<const std::vector<Mutation>>(std::move(unpublished_));
+    unpublished_.clear();
+    for (auto& copy : retired_) {
+        copy->pending.push_back(batch);
+    }
+    published_->pending.push_back(batch);
+
+    // The next standby is chosen while the current one is still the writer's alone, so that it can be copied
+    std::shared_ptr<Copy> next = takeReleased();
+    if (!next) {
+        next = copyStandby();
+    }
+    if (!next) {
+        ++writerWaits_;
+        retired_.front()->released.wait();
+        next = takeReleased();
+    }
+
+    // The standby copy becomes the current version, readers arriving after the
+    // swap get it while those holding the old version keep theirs
+    ++version_;
+    std::atomic_store(&current_, makeSnapshot(standby_, version_));
+    retired_.push_back(std::move(published_));
+    published_ = std::move(standby_);
+    standby_ = std::move(next);
+}
+
+void VersionedDatastructures::catchUp()
+{
+    // Nobody reads the standby copy, so the mutations it missed are replayed right away
+    for (const Batch& batch : standby_->pending) {
+        for (const Mutation& mutation : *batch) {
+            mutation(standby_->data);
+        }
+    }
+    standby_->pending.clear();
+}
+
+std::shared_ptr<VersionedDatastructures::Copy> VersionedDatastructures::takeReleased()
+{
+    // The first retired copy no reader holds is taken, the other free ones are dropped
+    std::shared_ptr<Copy> taken;
+    std::vector<std::shared_ptr<Copy>> held;
+    for (auto& copy : retired_) {
+        if (copy->released.valid() && copy->released.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            held.push_back(std::move(copy));
+        } else if (!taken) {
+            taken = std::move(copy);
+        }
+    }
+    retired_ = std::move(held);
+    return taken;
+}
+
+std::shared_ptr<VersionedDatastructures::Copy> VersionedDatastructures::copyStandby()
+{
+    // A snapshot carries everything the queries see, including the connection weights
+    std::stringstream data;
+    auto copy = std::make_shared<Copy>();
+    if (!standby_->data.save_snapshot(data) || !copy->data.load_snapshot(data)) {
+        return nullptr;
+    }
+    ++copiesMade_;
+    return copy;
+}
+
+std::shared_ptr<const VersionedDatastructures::Snapshot> VersionedDatastructures::makeSnapshot(const std::shared_ptr<Copy>& copy, std::uint64_t version)
+{
+    // The deleter runs when the last holder of the snapshot lets go of it. It
+    // shares the copy, so a snapshot held after this object is gone keeps its data.
+    auto released = std::make_shared<std::promise<void>>();
+    copy->released = released->get_future();
+    return std::shared_ptr<const Snapshot>(new Snapshot{version, copy->data}, [released, copy](const Snapshot* snapshot) {
+        delete snapshot;
+        released->set_value();
+    });
+}
@@ -0,0 +1,106 @@
+// VersionedDatastructures.hh
+//
+// Snapshot isolation over Datastructures for one writer and many readers.
+// Readers query the published copy of the data through a snapshot that stays
+// unchanged while they hold it. The writer changes a standby copy and publishes
+// it as the next version with one atomic pointer swap. The copy left behind is
+// retired. Once its last reader has let go of it, it becomes a standby again and
+// is brought up to date by replaying the mutations it missed.
+//
+// Usually three copies take turns: the published one, the standby and the one
+// published before, which readers still hold for a while. The writer never waits
+// for readers. If every retired copy is still held when a version is published,
+// the standby is copied through a snapshot to make a new standby. That costs
+// time and memory proportional to the data. Memory grows with the number of old
+// versions held at the same time, and copies nobody holds are dropped again.
+
+#ifndef VERSIONEDDATASTRUCTURES_HH
+#define VERSIONEDDATASTRUCTURES_HH
+
+#include "datastructures.hh"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class VersionedDatastructures
+{
+public:
+    // A consistent version of the data, unchanged for as long as it is held.
+    // It may be held after the VersionedDatastructures is gone.
+    struct Snapshot
+    {
+        std::uint64_t version;
+        const Datastructures& data;
+    };
+
+    // A change to the data. It is applied to every copy in turn, so it must do the
+    // same on each and not refer to anything that may be gone by the last time.
+    using Mutation = std::function<bool(Datastructures&)>;
+
+    // Mutations are published as a new version after every publishEvery of them, 0 leaves it to publish()
+    explicit VersionedDatastructures(unsigned int publishEvery = 1);
+
+    VersionedDatastructures(const VersionedDatastructures&) = delete;
+    VersionedDatastructures& operator=(const VersionedDatastructures&) = delete;
+
+    // The current version. Readers never wait for the writer, only the
+    // const queries of the data can be used through the snapshot.
+    std::shared_ptr<const Snapshot> snapshot() const;
+
+    // Applies the mutation to the next version and returns its result.
+    // Writers are serialized but never wait for readers.
+    bool write(Mutation mutation);
+
+    // Makes the mutations written so far visible to new snapshots
+    void publish();
+
+    // Statistics of the writer: the last published version, how many copies it made
+    // because readers held all retired ones, and how many times it waited for readers
+    // because the standby couldn't be copied (while a mapped image is open in it)
+    std::uint64_t version() const;
+    unsigned long copies_made() const;
+    unsigned long writer_waits() const;
+
+private:
+    using Batch = std::shared_ptr<const std::vector<Mutation>>;
+
+    struct Copy
+    {
+        Datastructures data;
+        // Published mutations this copy hasn't seen yet, in order
+        std::vector<Batch> pending;
+        // Ready once the last reader of its latest publication has let go of it,
+        // not valid if it has never been published
+        std::future<void> released;
+    };
+
+    void publishLocked();
+    void catchUp();
+    std::shared_ptr<Copy> takeReleased();
+    std::shared_ptr<Copy> copyStandby();
+    std::shared_ptr<const Snapshot> makeSnapshot(const std::shared_ptr<Copy>& copy, std::uint64_t version);
+
+    // The writer changes standby_, published_ is current_, and readers may still hold the retired copies.
+    // Snapshots share their copy, the writer reuses it only after the snapshot is released.
+    std::shared_ptr<Copy> published_;
+    std::shared_ptr<Copy> standby_;
+    std::vector<std::shared_ptr<Copy>> retired_;
+
+    // Accessed only with std::atomic_load and std::atomic_store
+    std::shared_ptr<const Snapshot> current_;
+
+    // Mutations applied to the standby copy but not yet published
+    std::vector<Mutation> unpublished_;
+
+    unsigned int publishEvery_ = 1;
+    std::uint64_t version_ = 0;
+    unsigned long copiesMade_ = 0;
+    unsigned long writerWaits_ = 0;
+    mutable std::mutex writeMutex_;
+};
+
+#endif // VERSIONEDDATASTRUCTURES_HH
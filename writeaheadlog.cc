@@ -0,0 +1,278 @@
+// WriteAheadLog.cc
+
+#include "writeaheadlog.hh"
+
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define WRITEAHEADLOG_FSYNC
+#endif
+
+namespace
+{
+// Buffered records are written out when the buffer grows past this
+std::size_t const WRITE_BUFFER_SIZE = 1 << 16;
+
+std::uint32_t fnv1a32(const char* data, std::size_t size)
+{
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void putVarint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+std::uint64_t zigzag(std::int64_t value)
+{
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t value)
+{
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+}
+
+std::unique_ptr<WriteAheadLog> WriteAheadLog::open(const std::string& filename, std::uint64_t validSize, unsigned int syncEvery)
+{
+    // Cut off whatever follows the last intact record before appending
+    std::error_code error;
+    if (std::filesystem::exists(filename, error) && std::filesystem::file_size(filename, error) > validSize) {
+        std::filesystem::resize_file(filename, validSize, error);
+        if (error) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<WriteAheadLog> log(new WriteAheadLog());
+    log->file_ = std::fopen(filename.c_str(), "ab");
+    if (!log->file_) {
+        return nullptr;
+    }
+    // Records are batched in buffer_, the file itself is unbuffered so a failed write can be retried exactly
+    std::setvbuf(log->file_, nullptr, _IONBF, 0);
+    log->syncEvery_ = syncEvery;
+    log->size_ = validSize;
+    log->buffer_.reserve(WRITE_BUFFER_SIZE + 1024);
+    return log;
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    if (file_) {
+        sync();
+        std::fclose(file_);
+    }
+}
+
+bool WriteAheadLog::add_affiliation(const AffiliationID& id, const Name& name, Coord xy)
+{
+    begin(LogOperation::ADD_AFFILIATION);
+    put(id);
+    put(name);
+    put(xy);
+    return commit();
+}
+
+bool WriteAheadLog::add_reference(PublicationID id, PublicationID parentid)
+{
+    begin(LogOperation::ADD_REFERENCE);
+    put(id);
+    put(parentid);
+    return commit();
+}
+
+bool WriteAheadLog::add_affiliation_to_publication(const AffiliationID& affiliationid, PublicationID publicationid)
+{
+    begin(LogOperation::ADD_AFFILIATION_TO_PUBLICATION);
+    put(affiliationid);
+    put(publicationid);
+    return commit();
+}
+
+bool WriteAheadLog::change_affiliation_coord(const AffiliationID& id, Coord xy)
+{
+    begin(LogOperation::CHANGE_AFFILIATION_COORD);
+    put(id);
+    put(xy);
+    return commit();
+}
+
+bool WriteAheadLog::remove_affiliation(const AffiliationID& id)
+{
+    begin(LogOperation::REMOVE_AFFILIATION);
+    put(id);
+    return commit();
+}
+
+bool WriteAheadLog::remove_publication(PublicationID id)
+{
+    begin(LogOperation::REMOVE_PUBLICATION);
+    put(id);
+    return commit();
+}
+
+bool WriteAheadLog::clear_all()
+{
+    begin(LogOperation::CLEAR_ALL);
+    return commit();
+}
+
+bool WriteAheadLog::begin_bulk_load()
+{
+    begin(LogOperation::BEGIN_BULK_LOAD);
+    return commit();
+}
+
+bool WriteAheadLog::end_bulk_load()
+{
+    begin(LogOperation::END_BULK_LOAD);
+    return commit();
+}
+
+void WriteAheadLog::begin(LogOperation operation)
+{
+    // The payload is built separately because its length goes in front of it
+    record_.clear();
+    record_.push_back(static_cast<char>(operation));
+}
+
+void WriteAheadLog::put(std::uint64_t value)
+{
+    putVarint(record_, value);
+}
+
+void WriteAheadLog::put(const std::string& text)
+{
+    putVarint(record_, text.size());
+    record_.append(text);
+}
+
+void WriteAheadLog::put(Coord xy)
+{
+    putVarint(record_, zigzag(xy.x));
+    putVarint(record_, zigzag(xy.y));
+}
+
+bool WriteAheadLog::commit()
+{
+    std::size_t start = buffer_.size();
+    putVarint(buffer_, record_.size());
+    buffer_.append(record_);
+    std::uint32_t checksum = fnv1a32(record_.data(), record_.size());
+    for (int i = 0; i < 4; ++i) {
+        buffer_.push_back(static_cast<char>(checksum >> (8 * i)));
+    }
+    size_ += buffer_.size() - start;
+
+    // Group commit: a batch of records shares one write and one fsync
+    ++unsynced_;
+    if (syncEvery_ != 0 && unsynced_ >= syncEvery_) {
+        return sync();
+    }
+    if (buffer_.size() >= WRITE_BUFFER_SIZE) {
+        return flush();
+    }
+    return !failed_;
+}
+
+bool WriteAheadLog::flush()
+{
+    // The file is unbuffered, so whatever fwrite reports written is in the file and only
+    // the rest is kept for the next try
+    std::size_t written = std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+    buffer_.erase(0, written);
+    failed_ = !buffer_.empty();
+    if (failed_) {
+        std::clearerr(file_);
+    }
+    return !failed_;
+}
+
+bool WriteAheadLog::sync()
+{
+    bool ok = flush();
+#ifdef WRITEAHEADLOG_FSYNC
+    ok = ok && fsync(fileno(file_)) == 0;
+    failed_ = !ok;
+#endif
+    if (ok) {
+        unsynced_ = 0;
+    }
+    return ok;
+}
+
+bool LogReader::next()
+{
+    pos_ = end_;
+    std::uint64_t size = 0;
+    // Compared without adding to size, a damaged length may be close to 2^64
+    if (!read(size, data_.size()) || size == 0 || size > data_.size() - pos_ || data_.size() - pos_ - size < 4) {
+        return false;
+    }
+
+    std::uint32_t checksum = 0;
+    for (int i = 0; i < 4; ++i) {
+        checksum |= std::uint32_t(static_cast<unsigned char>(data_[pos_ + size + i])) << (8 * i);
+    }
+    if (checksum != fnv1a32(data_.data() + pos_, size)) {
+        return false;
+    }
+
+    operation_ = static_cast<LogOperation>(data_[pos_]);
+    recordEnd_ = pos_ + size;
+    ++pos_;
+    end_ = recordEnd_ + 4;
+    return true;
+}
+
+bool LogReader::read(std::uint64_t& value, std::size_t limit)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos_ < limit; shift += 7) {
+        unsigned char byte = data_[pos_++];
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LogReader::get(std::uint64_t& value)
+{
+    return read(value, recordEnd_);
+}
+
+bool LogReader::get(std::string& text)
+{
+    std::uint64_t size = 0;
+    if (!read(size, recordEnd_) || recordEnd_ - pos_ < size) {
+        return false;
+    }
+    text.assign(data_, pos_, size);
+    pos_ += size;
+    return true;
+}
+
+bool LogReader::get(Coord& xy)
+{
+    std::uint64_t x = 0;
+    std::uint64_t y = 0;
+    if (!read(x, recordEnd_) || !read(y, recordEnd_)) {
+        return false;
+    }
+    xy = {static_cast<int>(unzigzag(x)), static_cast<int>(unzigzag(y))};
+    return true;
+}
@@ -0,0 +1,127 @@
+// WriteAheadLog.hh
+//
+// Append-only log of the mutating calls of Datastructures, replayed on open
+// so that nothing done since the last snapshot is lost in a crash.
+
+#ifndef WRITEAHEADLOG_HH
+#define WRITEAHEADLOG_HH
+
+#include "datastructures.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// Record layout: varint payload length, the payload (operation byte followed by
+// its fields) and a 32-bit FNV-1a checksum of the payload. Numbers are varints,
+// coordinates zigzag encoded, strings a varint length followed by the bytes.
+// A record that is cut short or fails its checksum ends the log.
+enum class LogOperation : unsigned char
+{
+    ADD_AFFILIATION = 1,
+    ADD_PUBLICATION,
+    ADD_REFERENCE,
+    ADD_AFFILIATION_TO_PUBLICATION,
+    CHANGE_AFFILIATION_COORD,
+    REMOVE_AFFILIATION,
+    REMOVE_PUBLICATION,
+    CLEAR_ALL,
+    BEGIN_BULK_LOAD,
+    END_BULK_LOAD
+};
+
+class WriteAheadLog
+{
+public:
+    // Opens the log for appending after its last intact record, a torn tail left
+    // by a crash is cut off. Records are made durable with one fsync for every
+    // syncEvery records (group commit), 0 leaves syncing to sync() and closing.
+    static std::unique_ptr<WriteAheadLog> open(const std::string& filename, std::uint64_t validSize, unsigned int syncEvery);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Each call appends one record and returns false if the buffered records couldn't
+    // be written out. They are kept and written again by the next write or sync.
+
+    bool add_affiliation(const AffiliationID& id, const Name& name, Coord xy);
+    template <typename Affiliations>
+    bool add_publication(PublicationID id, const Name& name, Year year, const Affiliations& affiliations);
+    bool add_reference(PublicationID id, PublicationID parentid);
+    bool add_affiliation_to_publication(const AffiliationID& affiliationid, PublicationID publicationid);
+    bool change_affiliation_coord(const AffiliationID& id, Coord xy);
+    bool remove_affiliation(const AffiliationID& id);
+    bool remove_publication(PublicationID id);
+    bool clear_all();
+    bool begin_bulk_load();
+    bool end_bulk_load();
+
+    // Offset at which the next record starts, buffered records included
+    std::uint64_t position() const { return size_; }
+
+    // Writes out the buffered records and waits until they are on disk
+    bool sync();
+
+private:
+    WriteAheadLog() = default;
+
+    void begin(LogOperation operation);
+    void put(std::uint64_t value);
+    void put(const std::string& text);
+    void put(Coord xy);
+    bool commit();
+    bool flush();
+
+    std::FILE* file_ = nullptr;
+    unsigned int syncEvery_ = 0;
+    unsigned int unsynced_ = 0;
+    bool failed_ = false;
+    std::uint64_t size_ = 0;
+    std::string record_;
+    std::string buffer_;
+};
+
+template <typename Affiliations>
+bool WriteAheadLog::add_publication(PublicationID id, const Name& name, Year year, const Affiliations& affiliations)
+{
+    begin(LogOperation::ADD_PUBLICATION);
+    put(id);
+    put(name);
+    put(year);
+    put(affiliations.size());
+    for (const AffiliationID& affiliationid : affiliations) {
+        put(affiliationid);
+    }
+    return commit();
+}
+
+// Walks the intact records of a log one at a time
+class LogReader
+{
+public:
+    explicit LogReader(const std::string& data) : data_(data) {}
+
+    // Moves to the next record, false at the end or at the first damaged record
+    bool next();
+    LogOperation operation() const { return operation_; }
+
+    bool get(std::uint64_t& value);
+    bool get(std::string& text);
+    bool get(Coord& xy);
+
+    // Bytes up to the end of the last intact record
+    std::uint64_t valid_size() const { return end_; }
+
+private:
+    bool read(std::uint64_t& value, std::size_t limit);
+
+    const std::string& data_;
+    std::size_t end_ = 0;
+    std::size_t pos_ = 0;
+    std::size_t recordEnd_ = 0;
+    LogOperation operation_ = LogOperation::CLEAR_ALL;
+};
+
+#endif // WRITEAHEADLOG_HH